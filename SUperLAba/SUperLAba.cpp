@@ -4,6 +4,30 @@
 #include <climits>
 #include <cstring>
 #include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <sstream>
+#include <random>
+#include <memory>
+#include <ctime>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <coroutine>
+#include <atomic>
+#include <chrono>
+#include <span>
+#include <functional>
+#include <cmath>
+#include <fstream>
+#include <filesystem>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LANES_SSE2
+#include <emmintrin.h>
+#endif
 using namespace std;
 
 enum rangeWeapon
@@ -13,102 +37,72 @@ enum rangeWeapon
 };
 
 
-// Узел queue
-struct Node
+// Поле одним массивом: клетка (x, y) лежит в cells[x * cols + y],
+// 1 — клетка свободна, 0 — стена или занята существом
+struct Grid
 {
-    // (x, y) представляет собой координаты ячейки матрицы, а
-    // `dist` представляет их минимальное расстояние от источника
-    int x, y, dist;
-    Node* prevNode;
-};
-
-// Ниже массивы детализируют все четыре возможных перемещения из ячейки
-int row[] = { -1, 0, 0, 1, 1, -1, 1, -1 };
-int col[] = { 0, -1, 1, 0, 1, -1, -1, 1 };
+    int rows = 0;
+    int cols = 0;
+    vector<uint8_t> cells;
 
-// Функция проверки возможности перехода на позицию (строка, столбец)
-// от текущей позиции. Функция возвращает false, если (строка, столбец)
-// недопустимая позиция или имеет значение 0 или уже посещено.
-bool isValid(vector<vector<int>> const& mat, vector<vector<bool>>& visited,
-    int row, int col) {
+    Grid() {}
 
-    return (row >= 0 && row < mat.size()) && (col >= 0 && col < mat[0].size())
-        && mat[row][col] && !visited[row][col];
-}
+    Grid(int rows, int cols, uint8_t value) : rows(rows), cols(cols), cells((size_t)rows * cols, value) {}
 
-// Находим кратчайший маршрут в матрице `mat` из источника
-// ячейка (i, j) в ячейку назначения (x, y)
-Node* findShortestPath(vector<vector<int>> const& mat, pair<int, int>& src,
-    pair<int, int>& dest)
-{
-    // базовый случай: неверный ввод
-    if (mat.size() == 0 || mat[src.first][src.second] == 0 ||
-        mat[dest.first][dest.second] == 0) {
-        return NULL;
+    bool isInside(int x, int y) const
+    {
+        return x >= 0 && x < rows && y >= 0 && y < cols;
     }
 
-    // Матрица `M × N`
-    int M = mat.size();
-    int N = mat[0].size();
-
-    // строим матрицу `M × N` для отслеживания посещенных ячеек
-    vector<vector<bool>> visited;
-    visited.resize(M, vector<bool>(N));
+    uint8_t& at(int x, int y)
+    {
+        return cells[(size_t)x * cols + y];
+    }
 
-    // создаем пустую queue
-    queue<Node> q;
+    uint8_t at(int x, int y) const
+    {
+        return cells[(size_t)x * cols + y];
+    }
+};
 
-    // получаем исходную ячейку (i, j)
-    int i = src.first;
-    int j = src.second;
+// Ниже массивы детализируют все восемь возможных перемещений из ячейки
+int row[] = { -1, 0, 0, 1, 1, -1, 1, -1 };
+int col[] = { 0, -1, 1, 0, 1, -1, -1, 1 };
 
-    // помечаем исходную ячейку как посещенную и ставим исходный узел в queue
-    visited[i][j] = true;
-    q.push({ i, j, 0, NULL });
+// Контекст боя, который исполняется на потоке планировщика: свой генератор
+// случайных чисел и свой поток вывода (NULL — бой идёт молча).
+// Пока контекст не задан, используются rand() и cout, как и раньше
+struct BattleContext
+{
+    mt19937 random;
+    ostream* log;
+};
 
-    // сохраняет длину самого длинного пути от источника к месту назначения
-    Node min_node;
-    int min_dist = INT_MAX;
+thread_local BattleContext* currentBattle = NULL;
 
-    // цикл до тех пор, пока queue не станет пустой
-    while (!q.empty())
-    {
-        // удалить передний узел из очереди и обработать его
-        Node node = q.front();
-        q.pop();
+// Бросок кубика d`maxDiceNumber`
+int rollDice(int maxDiceNumber)
+{
+    if (currentBattle == NULL) {
+        return 1 + rand() % maxDiceNumber;
+    }
 
-        // (i, j) представляет текущую ячейку, а `dist` хранит ее
-        // минимальное расстояние от источника
-        int i = node.x, j = node.y, dist = node.dist;
+    return 1 + (int)(currentBattle->random() % maxDiceNumber);
+}
 
-        // если пункт назначения найден, обновляем `min_dist` и останавливаемся
-        if (i == dest.first && j == dest.second)
-        {
-            min_node = node;
-            min_dist = dist;
-            break;
-        }
+ostream& gameLog()
+{
+    thread_local ostream silentLog(NULL);
 
-        // проверяем все четыре возможных перемещения из текущей ячейки
-        // и ставим в queue каждое допустимое движение
-        for (int k = 0; k < 8; k++)
-        {
-            // проверяем, можно ли выйти на позицию
-            // (i + row[k], j + col[k]) от текущей позиции
-            if (isValid(mat, visited, i + row[k], j + col[k]))
-            {
-                // отметить следующую ячейку как посещенную и поставить ее в queue
-                visited[i + row[k]][j + col[k]] = true;
-                q.push({ i + row[k], j + col[k], dist + 1, new Node({node.x, node.y, node.dist, node.prevNode}) });
-            }
-        }
+    if (currentBattle == NULL) {
+        return cout;
     }
 
-    if (min_dist != INT_MAX) {
-        return &min_node;
+    if (currentBattle->log == NULL) {
+        return silentLog;
     }
 
-    return NULL;
+    return *currentBattle->log;
 }
 
 class Weapon {
@@ -120,10 +114,11 @@ protected:
 
     rangeWeapon range;
 public:
-    Weapon(string name, int addDamage, int maxDiceNumber, int numberDiceRoll, rangeWeapon range)
+    Weapon(string name, int addDamage, int numberDiceRoll, int maxDiceNumber, rangeWeapon range)
     {
         this->name = name;
         this->addDamage = addDamage;
+        this->numberDiceRoll = numberDiceRoll;
         this->maxDiceNumber = maxDiceNumber;
         this->range = range;
     }
@@ -132,7 +127,7 @@ public:
     {
         int n = 0;
         for (int i = 0; i < this->numberDiceRoll; i++) {
-            n += 1 + rand() % this->maxDiceNumber;
+            n += rollDice(this->maxDiceNumber);
         }
 
         return n;
@@ -143,10 +138,26 @@ public:
         return this->name;
     }
 
+    int getNumberDiceRoll()
+    {
+        return this->numberDiceRoll;
+    }
+
+    int getMaxDiceNumber()
+    {
+        return this->maxDiceNumber;
+    }
+
     rangeWeapon getTypeWeapon()
     {
         return this->range;
     }
+
+    void setDice(int numberDiceRoll, int maxDiceNumber)
+    {
+        this->numberDiceRoll = numberDiceRoll;
+        this->maxDiceNumber = maxDiceNumber;
+    }
 };
 
 enum WeaponNames
@@ -192,6 +203,48 @@ public:
     }
 };
 
+// Характеристики существа без случайных бросков: их используют
+// пакетное ядро LaneBattleKernel и точный решатель
+struct CreatureProfile
+{
+    int armor;
+    int bonusAtack;
+    int bonusIniciative;
+    int speed;
+
+    int addHp;
+    int numberDiceRoll;
+    int maxDiceNumberForHp;
+
+    // Первое оружие существа — им оно бьёт, если не учитывать расстояние
+    int weaponNumberDiceRoll;
+    int weaponMaxDiceNumber;
+    rangeWeapon weaponRange;
+};
+
+// Правка характеристик всех существ одного типа для сравнения конфигураций.
+// -1 — оставить значение из класса существа
+struct CreatureOverride
+{
+    int armor = -1;
+    int bonusAtack = -1;
+    int bonusIniciative = -1;
+    // Кости первого оружия, NdM
+    int weaponNumberDiceRoll = -1;
+    int weaponMaxDiceNumber = -1;
+
+    void applyTo(CreatureProfile& profile)
+    {
+        if (armor >= 0) { profile.armor = armor; }
+        if (bonusAtack >= 0) { profile.bonusAtack = bonusAtack; }
+        if (bonusIniciative >= 0) { profile.bonusIniciative = bonusIniciative; }
+        if (weaponNumberDiceRoll >= 0) {
+            profile.weaponNumberDiceRoll = weaponNumberDiceRoll;
+            profile.weaponMaxDiceNumber = weaponMaxDiceNumber;
+        }
+    }
+};
+
 class Creature {
 protected:
     int health,
@@ -207,7 +260,8 @@ protected:
         positionX,
         positionY,
 
-        teamId;
+        teamId,
+        rosterHandle = -1;
 
     string name;
     vector<Weapon*> weapons;
@@ -224,10 +278,13 @@ protected:
 
     int initHp(int addHp, int numberDiceRoll, int maxDiceNumberForHp)
     {
+        this->addHp = addHp;
+        this->numberDiceRoll = numberDiceRoll;
+        this->maxDiceNumberForHp = maxDiceNumberForHp;
         this->health = addHp;
 
         for (int i = 0; i < numberDiceRoll; i++) {
-            this->health += 1 + rand() % maxDiceNumberForHp;
+            this->health += rollDice(maxDiceNumberForHp);
         }
 
         return this->health;
@@ -266,7 +323,7 @@ protected:
     }
 
     bool checkArmor(int arm) {
-        int d20 = 1 + rand() % 20 + this->bonusAtack;
+        int d20 = rollDice(20) + this->bonusAtack;
         if (d20 >= arm) {
             return true;
         }
@@ -294,21 +351,35 @@ public:
         this->teamId = teamId;
     }
 
+    virtual ~Creature()
+    {
+        for (int i = 0; i < weapons.size(); i++)
+        {
+            delete weapons[i];
+        }
+    }
+
     int getIniciative()
     {
         return this->bonusIniciative;
     }
 
+    // Сколько клеток существо проходит за ход
+    int getSpeed()
+    {
+        return this->speed;
+    }
+
     void getInfo() {
-        cout << endl << "-HP " << this->health << endl << "-Armor " << this->armor << endl
+        gameLog() << endl << "-HP " << this->health << endl << "-Armor " << this->armor << endl
             << "-Bonus atack= " << this->bonusAtack << endl << "-Bonus iniciative= " << this->bonusIniciative << endl;
         for (int i = 0; i < weapons.size(); i++)
         {
 
             string nameWeapon = weapons[i]->getName();
-            cout << "Weapon " + i << nameWeapon << endl;
+            gameLog() << "Weapon " + i << nameWeapon << endl;
         }
-        cout << "-Move" << this->speed << endl;
+        gameLog() << "-Move" << this->speed << endl;
     }
 
     int getTeamId()
@@ -316,6 +387,32 @@ public:
         return this->teamId;
     }
 
+    void applyOverride(CreatureOverride creatureOverride)
+    {
+        if (creatureOverride.armor >= 0) { this->armor = creatureOverride.armor; }
+        if (creatureOverride.bonusAtack >= 0) { this->bonusAtack = creatureOverride.bonusAtack; }
+        if (creatureOverride.bonusIniciative >= 0) { this->bonusIniciative = creatureOverride.bonusIniciative; }
+        if (creatureOverride.weaponNumberDiceRoll >= 0) {
+            this->weapons[0]->setDice(creatureOverride.weaponNumberDiceRoll, creatureOverride.weaponMaxDiceNumber);
+        }
+    }
+
+    CreatureProfile getProfile()
+    {
+        CreatureProfile profile;
+        profile.armor = this->armor;
+        profile.bonusAtack = this->bonusAtack;
+        profile.bonusIniciative = this->bonusIniciative;
+        profile.speed = this->speed;
+        profile.addHp = this->addHp;
+        profile.numberDiceRoll = this->numberDiceRoll;
+        profile.maxDiceNumberForHp = this->maxDiceNumberForHp;
+        profile.weaponNumberDiceRoll = this->weapons[0]->getNumberDiceRoll();
+        profile.weaponMaxDiceNumber = this->weapons[0]->getMaxDiceNumber();
+        profile.weaponRange = this->weapons[0]->getTypeWeapon();
+        return profile;
+    }
+
     string getName()
     {
         return this->name;
@@ -344,15 +441,15 @@ public:
 
     void setCoordinate(int positionX, int positionY)
     {
-        cout << this->name << " перешёл на координаты " << "x - " << positionX << " y - " << positionY << std::endl;
-        cout << this->name << " старые координаты " << "x - " << this->positionX << " y - " << this->positionY << std::endl;
+        gameLog() << this->name << " перешёл на координаты " << "x - " << positionX << " y - " << positionY << std::endl;
+        gameLog() << this->name << " старые координаты " << "x - " << this->positionX << " y - " << this->positionY << std::endl;
         this->positionX = positionX;
         this->positionY = positionY;
     }
 
     void attack(Creature* enemy)
     {
-        cout << this->name << " бьёт " << enemy->getName() << std::endl;
+        gameLog() << this->name << " бьёт " << enemy->getName() << std::endl;
 
         if (enemy->checkArmor(enemy->getArmor())) {
             this->positionX;
@@ -361,12 +458,12 @@ public:
             Weapon* choosenWeapon = this->getWeaponForBitEbalo(enemyCoordinates.first, enemyCoordinates.second);
 
             enemy->changeHP(choosenWeapon->getDamage() + this->bonusAtack);
-            cout << enemy->getName() << " получил удар:" << choosenWeapon->getDamage() + this->bonusAtack
+            gameLog() << enemy->getName() << " получил удар:" << choosenWeapon->getDamage() + this->bonusAtack
                 << " на урона" << " от " << choosenWeapon->getName()
                 << " у живичка осталось хп - " << enemy->getHp() << std::endl;
         }
         else {
-            cout << enemy->getName() << " увернулся от маслины" << std::endl;
+            gameLog() << enemy->getName() << " увернулся от маслины" << std::endl;
         }
     }
 
@@ -387,6 +484,16 @@ public:
     {
         this->teamId = i;
     }
+
+    int getRosterHandle()
+    {
+        return this->rosterHandle;
+    }
+
+    void setRosterHandle(int handle)
+    {
+        this->rosterHandle = handle;
+    }
 };
 
 class Wolf :public Creature {
@@ -502,352 +609,4357 @@ public:
     }
 };
 
-class Area {
-private:
-    int N;
-    vector<Creature*> teamA;
-    vector<Creature*> teamB;
-    vector<vector<int>> map;
+enum TerrainNames
+{
+    field,
+    caves,
+    forest,
+    rooms,
+};
 
-    void generateMap()
+bool findTerrainByName(string terrainName, TerrainNames& terrain)
+{
+    const char* names[] = { "field", "caves", "forest", "rooms" };
+    for (int i = 0; i < 4; i++)
     {
-        for (int i = 0; i < N; i++)
+        if (terrainName == names[i])
         {
-            vector<int> mapRow;
+            terrain = (TerrainNames)i;
+            return true;
+        }
+    }
 
-            for (int j = 0; j < N; j++)
-            {
-                mapRow.push_back(1);
-            }
+    return false;
+}
 
-            map.push_back(mapRow);
-        }
+// Номера областей по клеткам: пока областей меньше 65536, на клетку хватает
+// двух байт, иначе — четыре
+struct RegionMap
+{
+    vector<uint16_t> narrow;
+    vector<int32_t> wide;
+
+    int operator[](size_t cell) const
+    {
+        return wide.empty() ? narrow[cell] : wide[cell];
     }
 
-    void generatePositionForHeroes()
+    size_t size() const
     {
-        for (int i = 0; i < this->teamA.size(); i++)
-        {
-            bool isSetPosition = false;
+        return wide.empty() ? narrow.size() : wide.size();
+    }
+};
 
-            while (!isSetPosition)
-            {
-                int posX = rand() % N;
-                int posY = rand() % N;
+struct Terrain
+{
+    Grid grid;
+    // Номер связной области свободной клетки (соседство по 8 направлениям,
+    // как ходят существа), 0 — стена
+    RegionMap regions;
+    int regionCount = 0;
+
+    // Самая большая область, 0 — свободных клеток нет; считается последовательно,
+    // для арен боя этого хватает
+    int findLargestRegion()
+    {
+        vector<int> sizes(regionCount + 1, 0);
+        for (size_t i = 0; i < regions.size(); i++) {
+            sizes[regions[i]]++;
+        }
 
-                int isPlaceTaken = map[posX][posY];
-                if (isPlaceTaken == 1)
-                {
-                    map[posX][posY] = 0;
-                    teamA[i]->setCoordinate(posX, posY);
-                    isSetPosition = true;
-                }
+        int largest = 0;
+        for (int r = 1; r <= regionCount; r++) {
+            if (largest == 0 || sizes[r] > sizes[largest]) {
+                largest = r;
             }
         }
 
-        for (int i = 0; i < teamB.size(); i++)
-        {
-            bool isSetPosition = false;
+        return largest;
+    }
+};
 
-            while (!isSetPosition)
-            {
-                int posX = rand() % N;
-                int posY = rand() % N;
+// Общий пул потоков для параллельных циклов (генерация арен, аукцион целей):
+// потоки создаются один раз на процесс, а не на каждый цикл. Вызывающий поток
+// сам берёт задачи своего цикла, поэтому цикл закончится, даже если все потоки
+// пула заняты циклами других боёв
+class ParallelPool
+{
+public:
+    static ParallelPool& shared()
+    {
+        static ParallelPool pool(max((int)thread::hardware_concurrency() - 1, 0));
+        return pool;
+    }
 
-                int isPlaceTaken = map[posX][posY];
-                if (isPlaceTaken == 1)
-                {
-                    map[posX][posY] = 0;
-                    teamB[i]->setCoordinate(posX, posY);
-                    isSetPosition = true;
-                }
-            }
+    ParallelPool(int workerCount)
+    {
+        for (int i = 0; i < workerCount; i++)
+        {
+            workers.push_back(thread(&ParallelPool::workerLoop, this));
         }
     }
 
-public:
-    Area(int N, vector<Creature*> teamA, vector<Creature*> teamB)
+    ParallelPool(const ParallelPool&) = delete;
+    ParallelPool& operator=(const ParallelPool&) = delete;
+
+    ~ParallelPool()
     {
-        this->N = N;
-        this->teamA = teamA;
-        this->teamB = teamB;
+        {
+            lock_guard<mutex> lock(poolMutex);
+            isStopping = true;
+        }
+        jobAdded.notify_all();
 
-        generateMap();
-        generatePositionForHeroes();
+        for (int i = 0; i < (int)workers.size(); i++)
+        {
+            workers[i].join();
+        }
     }
 
-    //TODO 
-    Creature* findEnemy(Creature* hero, vector<Creature*> enemies)
+    // Вызывает body(task) для каждого task от 0 до taskCount - 1, занимая
+    // не больше threadCount потоков вместе с вызывающим; возвращается, когда всё сделано
+    void forEach(int taskCount, int threadCount, function<void(int)> body)
     {
-        pair<int, int> heroCoordinate = hero->getCoordinate();
-        Creature* nearestEnemy = NULL;
-        Node* nearestEnemyNode = NULL;
-        int nearestRangeToEnemy = INT32_MAX;
-        int index = 0;
+        Job job;
+        job.body = &body;
+        job.taskCount = taskCount;
+        job.helperLimit = min(threadCount, taskCount) - 1;
 
-        for (int i = 0; i < enemies.size(); i++) {
-            pair<int, int> enemyCoordinate = enemies[i]->getCoordinate();
+        bool isShared = job.helperLimit > 0 && !workers.empty();
+        if (isShared)
+        {
+            lock_guard<mutex> lock(poolMutex);
+            jobs.push_back(&job);
+            jobAdded.notify_all();
+        }
 
-            map[enemyCoordinate.first][enemyCoordinate.second] = 1;
-            map[heroCoordinate.first][heroCoordinate.second] = 1;
+        runTasks(job);
 
-            Node* shortestPath = findShortestPath(map, heroCoordinate, enemyCoordinate);
+        if (isShared)
+        {
+            unique_lock<mutex> lock(poolMutex);
+            jobs.erase(find(jobs.begin(), jobs.end(), &job));
+            jobDone.wait(lock, [&]() { return job.helpers == 0; });
+        }
+    }
 
-            map[enemyCoordinate.first][enemyCoordinate.second] = 0;
-            map[heroCoordinate.first][heroCoordinate.second] = 0;
+private:
+    struct Job
+    {
+        function<void(int)>* body;
+        int taskCount;
+        atomic<int> nextTask{ 0 };
+        // Сколько потоков пула сейчас помогают и сколько им можно
+        int helpers = 0;
+        int helperLimit;
+    };
+
+    vector<thread> workers;
+    mutex poolMutex;
+    condition_variable jobAdded;
+    condition_variable jobDone;
+    deque<Job*> jobs;
+    bool isStopping = false;
+
+    static void runTasks(Job& job)
+    {
+        for (int task = job.nextTask++; task < job.taskCount; task = job.nextTask++) {
+            (*job.body)(task);
+        }
+    }
 
-            if (shortestPath != NULL && shortestPath->dist < nearestRangeToEnemy)
-            {
-                index = i;
-                nearestEnemy = enemies[i];
-                nearestEnemyNode = shortestPath;
+    Job* findJob()
+    {
+        for (int i = 0; i < (int)jobs.size(); i++)
+        {
+            if (jobs[i]->helpers < jobs[i]->helperLimit && jobs[i]->nextTask < jobs[i]->taskCount) {
+                return jobs[i];
             }
         }
 
-        //Если чувак ближнего боя переместить его в врагу
-        if (nearestEnemyNode != NULL && hero->getWeaponForBitEbalo(nearestEnemyNode->x, nearestEnemyNode->y) == NULL)
+        return NULL;
+    }
+
+    void workerLoop()
+    {
+        unique_lock<mutex> lock(poolMutex);
+
+        while (true)
         {
-            nearestEnemy->getCoordinate();
-            hero->getCoordinate();
+            Job* job = NULL;
+            jobAdded.wait(lock, [&]() { return isStopping || (job = findJob()) != NULL; });
+            if (isStopping) {
+                return;
+            }
 
-            pair<int, int> enemyCoordinate = enemies[index]->getCoordinate();
+            job->helpers++;
+            lock.unlock();
+            runTasks(*job);
+            lock.lock();
 
-            map[enemyCoordinate.first][enemyCoordinate.second] = 1;
-            map[heroCoordinate.first][heroCoordinate.second] = 1;
+            job->helpers--;
+            jobDone.notify_all();
+        }
+    }
+};
 
-            Node* shortestPath = findShortestPath(map, heroCoordinate, enemyCoordinate);
+// Процедурные арены: пещеры клеточным автоматом, лес по шуму, комнаты с
+// коридорами. Поле режется на плитки, плитки раздаются потокам. Случайность
+// берётся из хеша (зерно, клетка), а не из общего генератора, поэтому
+// результат зависит только от зерна, но не от числа потоков и порядка плиток.
+// Области размечаются тут же: плитка, закончив клетки, сразу связывает их
+// системой непересекающихся множеств по своим клеткам, затем сшиваются
+// границы плиток — уже по корням плиток, а не по клеткам
+class TerrainGenerator
+{
+public:
+    TerrainGenerator(int tileSize = 256, int threadCount = (int)thread::hardware_concurrency())
+    {
+        this->tileSize = min(max(tileSize, 8), MAX_TILE_SIZE);
+        this->threadCount = max(threadCount, 1);
+    }
 
-            map[enemyCoordinate.first][enemyCoordinate.second] = 0;
-            map[heroCoordinate.first][heroCoordinate.second] = 0;
+    Terrain generate(TerrainNames terrainName, int rows, int cols, uint32_t seed)
+    {
+        Terrain terrain;
 
-            map[heroCoordinate.first][heroCoordinate.second] = 1;
-            map[nearestEnemyNode->prevNode->x][nearestEnemyNode->prevNode->y] = 0;
-            hero->setCoordinate(nearestEnemyNode->prevNode->x, nearestEnemyNode->prevNode->y);
+        // Номера клеток хранятся в int32_t
+        if ((long long)rows * cols >= INT_MAX) {
+            return terrain;
         }
-        else {
-            //Если чувак дальнего боя 
 
-            Creature* randEnemy = enemies[rand() % (enemies.size())];
-            if (hero->getWeaponForBitEbalo(randEnemy->getCoordinate().first, randEnemy->getCoordinate().second) != NULL)
+        terrain.grid = Grid(rows, cols, 1);
+        this->seed = seed;
+        this->rows = rows;
+        this->cols = cols;
+        tileLabels.assign((size_t)rows * cols, 0);
+        tileRootCells.assign((size_t)((rows + tileSize - 1) / tileSize) * ((cols + tileSize - 1) / tileSize), {});
+
+        // Мелкие арены обычного боя не стоят раздачи по потокам
+        isParallel = (long long)rows * cols >= (1 << 16);
+
+        Grid& grid = terrain.grid;
+        if (terrainName == caves)
+        {
+            Grid next(rows, cols, 0);
+            forEachTile([&](int x0, int x1, int y0, int y1) {
+                for (int x = x0; x < x1; x++)
+                    for (int y = y0; y < y1; y++)
+                        grid.at(x, y) = !isBorder(x, y) && hash(x, y, 0) % 100 >= CAVE_WALL_PERCENT;
+            });
+
+            for (int step = 0; step < CAVE_STEPS; step++)
             {
-                nearestEnemy = randEnemy;
+                bool isLast = step + 1 == CAVE_STEPS;
+                forEachTile([&](int x0, int x1, int y0, int y1) {
+                    smoothCaves(grid, next, x0, x1, y0, y1);
+                    if (isLast) {
+                        labelTile(next, x0, x1, y0, y1);
+                    }
+                });
+                swap(grid.cells, next.cells);
             }
         }
-
-        if (nearestEnemy == NULL)
+        else
         {
-            return NULL;
+            if (terrainName == rooms)
+            {
+                int blocksX = (rows + ROOM_BLOCK - 1) / ROOM_BLOCK;
+                roomBlocksY = (cols + ROOM_BLOCK - 1) / ROOM_BLOCK;
+                roomCache.resize((size_t)blocksX * roomBlocksY);
+
+                ParallelPool::shared().forEach(blocksX, isParallel ? threadCount : 1, [&](int blockX) {
+                    for (int blockY = 0; blockY < roomBlocksY; blockY++) {
+                        roomCache[(size_t)blockX * roomBlocksY + blockY] = makeRoom(blockX, blockY);
+                    }
+                });
+            }
+
+            forEachTile([&](int x0, int x1, int y0, int y1) {
+                if (terrainName == forest) {
+                    fillForest(grid, x0, x1, y0, y1);
+                }
+                else if (terrainName == rooms) {
+                    fillRooms(grid, x0, x1, y0, y1);
+                }
+
+                labelTile(grid, x0, x1, y0, y1);
+            });
         }
 
-        return nearestEnemy;
+        mergeTiles(grid);
+        roomCache = vector<Room>();
+        numberRegions(grid, terrain);
+
+        return terrain;
     }
 
-    void clearPosition(int x, int y)
+private:
+    static const int CAVE_WALL_PERCENT = 45;
+    static const int CAVE_STEPS = 4;
+    static const int FOREST_SCALE = 24;
+    static const int ROOM_BLOCK = 16;
+    // Клетки плитки нумеруются в uint16_t
+    static const int MAX_TILE_SIZE = 256;
+
+    int tileSize;
+    int threadCount;
+    bool isParallel;
+    uint32_t seed;
+    int rows, cols;
+    // Разметка плиток: у свободной клетки — номер корня её плитки (1, 2, … по
+    // порядку строк плитки), у стены — 0. После numberRegions — номер области
+    vector<uint16_t> tileLabels;
+    // Клетки корней каждой плитки по порядку их номеров
+    vector<vector<int32_t>> tileRootCells;
+    // Сшивка: система непересекающихся множеств по корням всех плиток. Корень
+    // плитки t с номером k — элемент rootsBefore[t] + k - 1; корень множества —
+    // элемент с наименьшей клеткой, как если бы клетки связывались напрямую
+    vector<int32_t> parent;
+    vector<int32_t> rootCell;
+    vector<int> rootsBefore;
+
+    struct Room
+    {
+        int x0, x1, y0, y1;
+    };
+    // Комнаты всех блоков считаются заранее: клетке нужны комнаты до пяти блоков
+    vector<Room> roomCache;
+    int roomBlocksY = 0;
+
+    template <class TileFunction>
+    void forEachTile(TileFunction function)
     {
-        this->map[x][y] = 1;
+        int tileRows = (rows + tileSize - 1) / tileSize;
+        int tileCols = (cols + tileSize - 1) / tileSize;
+
+        ParallelPool::shared().forEach(tileRows * tileCols, isParallel ? threadCount : 1, [&](int t) {
+            int x0 = t / tileCols * tileSize;
+            int y0 = t % tileCols * tileSize;
+            function(x0, min(x0 + tileSize, rows), y0, min(y0 + tileSize, cols));
+        });
     }
-};
-
-class Game {
-public:
-    int round_count = 0;
-    vector<Creature*> team1;
-    vector<Creature*> team2;
-    map<Creature*, int> listIniciative;
-    Area* area;
 
-    void StartGame() {
-        InitializeGame();
+    uint32_t hash(uint32_t x, uint32_t y, uint32_t salt)
+    {
+        uint32_t h = seed * 0x9e3779b1u ^ x * 0x85ebca6bu ^ y * 0xc2b2ae35u ^ salt * 0x27d4eb2fu;
+        h ^= h >> 15;
+        h *= 0x2c1b3c6du;
+        h ^= h >> 12;
+        h *= 0x297a2d39u;
+        h ^= h >> 15;
+        return h;
+    }
 
-        game();
+    bool isBorder(int x, int y)
+    {
+        return x == 0 || y == 0 || x == rows - 1 || y == cols - 1;
     }
 
-private:
-    bool isGame = false;
-    void InitializeGame()
+    // Клетка становится стеной, если в квадрате 3×3 вокруг неё не меньше 5 стен.
+    // Сначала по строке считаются суммы трёх клеток каждого столбца, затем квадрат —
+    // сумма трёх соседних столбцов
+    void smoothCaves(Grid& from, Grid& to, int x0, int x1, int y0, int y1)
     {
-        this->team1 = vector<Creature*>{ new Bear("bear1", 1), new Bear("bear2", 1), new Wolf("wolf1", 1), new Wolf("wolf2", 1), new Wolf("wolf3", 1), new Wolf("wolf4", 1) };
-        this->team2 = vector<Creature*>{ new Barbarian("barbarian1", 2), new Barbarian("barbarian2", 2), new Pathfinder("pathfinder1", 2), new Pathfinder("pathfinder2", 2) }; // 
-        this->area = new Area(10, this->team1, this->team2);
+        // columnSum[k] — столбец y0 - 1 + k
+        vector<uint8_t> columnSum(y1 - y0 + 2, 0);
+        int innerY0 = max(y0, 1), innerY1 = min(y1, cols - 1);
 
-        initIniciativeCreatures();
-        isGame = true;
+        for (int x = x0; x < x1; x++)
+        {
+            uint8_t* out = &to.cells[(size_t)x * cols];
+            if (x == 0 || x == rows - 1) {
+                fill(out + y0, out + y1, 0);
+                continue;
+            }
 
-        coutInfoAboutTeam(this->team1, "команда зверей");
-        coutInfoAboutTeam(this->team2, "команда людей");
-        coutInfoAboutIniciative();
-    }
+            const uint8_t* up = &from.cells[(size_t)(x - 1) * cols];
+            const uint8_t* middle = up + cols;
+            const uint8_t* down = middle + cols;
 
-    void initIniciativeCreatures()
-    {
-        for (int i = 0; i < this->team1.size(); i++) {
-            this->listIniciative[this->team1[i]] = 1 + rand() % 20 + this->team1[i]->getIniciative();
-        }
+            for (int y = max(y0 - 1, 0); y < min(y1 + 1, cols); y++) {
+                columnSum[y - y0 + 1] = up[y] + middle[y] + down[y];
+            }
+
+            for (int y = innerY0; y < innerY1; y++) {
+                out[y] = columnSum[y - y0] + columnSum[y - y0 + 1] + columnSum[y - y0 + 2] >= 5;
+            }
 
-        for (int i = 0; i < this->team2.size(); i++) {
-            this->listIniciative[this->team2[i]] = 1 + rand() % 20 + this->team2[i]->getIniciative();
+            if (y0 == 0) { out[0] = 0; }
+            if (y1 == cols) { out[cols - 1] = 0; }
         }
+    }
 
-        //Сортировка по инициативе
-        //for (int i = 0; i < this->listIniciative.size(); i++) {
-        //    listIniciative
-        //}
+    // Узлы решётки шума, нужные одной плитке: хеш узла считается один раз на плитку,
+    // а не четырежды на каждую клетку
+    struct LatticeNodes
+    {
+        int scale;
+        int gx0, gy0;
+        int columns;
+        vector<double> values;
+    };
+
+    LatticeNodes makeLatticeNodes(int x0, int x1, int y0, int y1, int scale, uint32_t salt)
+    {
+        LatticeNodes nodes;
+        nodes.scale = scale;
+        nodes.gx0 = x0 / scale;
+        nodes.gy0 = y0 / scale;
+        nodes.columns = (y1 - 1) / scale + 2 - nodes.gy0;
+        int nodeRows = (x1 - 1) / scale + 2 - nodes.gx0;
+
+        nodes.values.resize((size_t)nodeRows * nodes.columns);
+        for (int i = 0; i < nodeRows; i++)
+            for (int j = 0; j < nodes.columns; j++)
+                nodes.values[(size_t)i * nodes.columns + j] = hash(nodes.gx0 + i, nodes.gy0 + j, salt) / 4294967296.0;
+
+        return nodes;
     }
 
-    void coutInfoAboutIniciative()
+    // Номер узла и гладкий вес вдоль одной оси решётки
+    static void latticeAxis(int scale, int base, int coordinate, int& index, double& weight)
     {
-        map <Creature*, int> ::iterator iter = this->listIniciative.begin();
+        index = coordinate / scale - base;
+        weight = (double)(coordinate % scale) / scale;
+        weight = weight * weight * (3 - 2 * weight);
+    }
 
-        cout << "Инициатива:" << std::endl;
+    // Гладкая интерполяция шума решётки, от 0 до 1
+    static double latticeNoise(const LatticeNodes& nodes, int gx, double fx, int gy, double fy)
+    {
+        const double* near = &nodes.values[(size_t)gx * nodes.columns + gy];
+        const double* far = near + nodes.columns;
+        double v00 = near[0], v01 = near[1];
+        double v10 = far[0], v11 = far[1];
 
-        for (int i = 0; iter != this->listIniciative.end(); iter++, i++) {
-            cout << "Имя: " << iter->first->getName() << " инициатива: " << iter->second << std::endl;
-        }
+        return (v00 * (1 - fy) + v01 * fy) * (1 - fx) + (v10 * (1 - fy) + v11 * fy) * fx;
     }
 
-    void game()
+    // Рощи там, где шум выше порога, и редкие одиночные деревья
+    void fillForest(Grid& grid, int x0, int x1, int y0, int y1)
     {
-        while (isGame)
+        LatticeNodes groves = makeLatticeNodes(x0, x1, y0, y1, FOREST_SCALE, 1);
+        LatticeNodes detail = makeLatticeNodes(x0, x1, y0, y1, FOREST_SCALE / 4, 2);
+
+        // Веса по столбцам одинаковы для всех строк плитки
+        int width = y1 - y0;
+        vector<int> grovesY(width), detailY(width);
+        vector<double> grovesFy(width), detailFy(width);
+        for (int y = y0; y < y1; y++)
         {
-            //stepCheckStatusCreatures();
+            latticeAxis(groves.scale, groves.gy0, y, grovesY[y - y0], grovesFy[y - y0]);
+            latticeAxis(detail.scale, detail.gy0, y, detailY[y - y0], detailFy[y - y0]);
+        }
 
-            if (this->isGame == false)
+        for (int x = x0; x < x1; x++)
+        {
+            int grovesX, detailX;
+            double grovesFx, detailFx;
+            latticeAxis(groves.scale, groves.gx0, x, grovesX, grovesFx);
+            latticeAxis(detail.scale, detail.gx0, x, detailX, detailFx);
+
+            for (int y = y0; y < y1; y++)
             {
-                return;
+                int i = y - y0;
+                double noise = 0.65 * latticeNoise(groves, grovesX, grovesFx, grovesY[i], grovesFy[i])
+                    + 0.35 * latticeNoise(detail, detailX, detailFx, detailY[i], detailFy[i]);
+                grid.at(x, y) = noise < 0.62 && hash(x, y, 3) % 100 >= 3;
             }
-
-            battle();
         }
     }
 
-    void battle()
+    // Комната блока из roomCache
+    void getRoom(int blockX, int blockY, int& x0, int& x1, int& y0, int& y1)
     {
-        map <Creature*, int> ::iterator it = this->listIniciative.begin();
+        const Room& room = roomCache[(size_t)blockX * roomBlocksY + blockY];
+        x0 = room.x0;
+        x1 = room.x1;
+        y0 = room.y0;
+        y1 = room.y1;
+    }
 
-        for (int i = 0; it != this->listIniciative.end(); it++, i++) {
-            if (it->first->isAlive() && isGame == true)
-            {
-                if (it->first->getTeamId() == 1) {
-                    stepDamageEnemy(it->first, team2);
-                }
-                else {
-                    stepDamageEnemy(it->first, team1);
-                }
-            }
-        }
+    // Каждый блок ROOM_BLOCK×ROOM_BLOCK держит одну комнату со случайными размерами
+    Room makeRoom(int blockX, int blockY)
+    {
+        int blockX0 = blockX * ROOM_BLOCK, blockX1 = min(blockX0 + ROOM_BLOCK, rows) - 1;
+        int blockY0 = blockY * ROOM_BLOCK, blockY1 = min(blockY0 + ROOM_BLOCK, cols) - 1;
+        // Стена по краю поля и по краю блока
+        blockX0 = max(blockX0 + 1, 1);
+        blockY0 = max(blockY0 + 1, 1);
+        blockX1 = max(min(blockX1 - 1, rows - 2), blockX0);
+        blockY1 = max(min(blockY1 - 1, cols - 2), blockY0);
+
+        uint32_t h = hash(blockX, blockY, 4);
+        int height = 1 + (int)(h % (blockX1 - blockX0 + 1));
+        int width = 1 + (int)((h >> 8) % (blockY1 - blockY0 + 1));
+        height = max(height, min(4, blockX1 - blockX0 + 1));
+        width = max(width, min(4, blockY1 - blockY0 + 1));
+
+        Room room;
+        room.x0 = blockX0 + (int)((h >> 16) % (blockX1 - blockX0 - height + 2));
+        room.y0 = blockY0 + (int)((h >> 24) % (blockY1 - blockY0 - width + 2));
+        room.x1 = room.x0 + height - 1;
+        room.y1 = room.y0 + width - 1;
+        return room;
     }
 
-    //TODO переписать методы определения id команды существа
-    void stepCheckStatusCreatures()
+    void getRoomCenter(int blockX, int blockY, int& x, int& y)
     {
-        map <Creature*, int> ::iterator it = this->listIniciative.begin();
-        vector<Creature*> deadCreatures;
+        int x0, x1, y0, y1;
+        getRoom(blockX, blockY, x0, x1, y0, y1);
+        x = (x0 + x1) / 2;
+        y = (y0 + y1) / 2;
+    }
 
-        for (int i = 0; it != this->listIniciative.end(); it++, i++) {
-            it->first;
-            if (!it->first->isAlive())
-            {
-                deadCreatures.push_back(it->first);
-            }
+    // Коридор буквой Г между центрами соседних комнат — два отрезка, каждый передаётся
+    // в paint прямоугольником x0..x1, y0..y1 включительно
+    template <class Paint>
+    void paintCorridor(int blockX, int blockY, int nextX, int nextY, Paint paint)
+    {
+        int blocksX = (rows + ROOM_BLOCK - 1) / ROOM_BLOCK, blocksY = (cols + ROOM_BLOCK - 1) / ROOM_BLOCK;
+        if (blockX < 0 || blockY < 0 || nextX >= blocksX || nextY >= blocksY) {
+            return;
         }
 
-        for (int i = 0; i < deadCreatures.size(); i++) {
-            if (deadCreatures[i]->getTeamId() == 1) {
-                clearInfoAboutDeadCreature(deadCreatures[i], getIndexEnemy(deadCreatures[i], team1));
-            }
-            else {
-                clearInfoAboutDeadCreature(deadCreatures[i], getIndexEnemy(deadCreatures[i], team2));
-            }
-        }
+        int ax, ay, bx, by;
+        getRoomCenter(blockX, blockY, ax, ay);
+        getRoomCenter(nextX, nextY, bx, by);
 
+        if (nextY != blockY) {
+            // Соседи по горизонтали: вдоль строки первого, потом по столбцу второго
+            paint(ax, ax, min(ay, by), max(ay, by));
+            paint(min(ax, bx), max(ax, bx), by, by);
+            return;
+        }
 
+        // Соседи по вертикали: вдоль столбца первого, потом по строке второго
+        paint(min(ax, bx), max(ax, bx), ay, ay);
+        paint(bx, bx, min(ay, by), max(ay, by));
     }
 
-    void clearInfoAboutDeadCreature(Creature* creature, int index)
+    // Комната и коридоры рисуются прямоугольниками, а не проверяются в каждой клетке.
+    // Клетка свободна, если она в комнате своего блока или на коридоре от него к одному
+    // из четырёх соседей, — поэтому всё рисуется только в пределах самого блока
+    void fillRooms(Grid& grid, int x0, int x1, int y0, int y1)
     {
-        int teamId = creature->getTeamId();
-
-        this->listIniciative.erase(creature);
-        this->area->clearPosition(creature->getCoordinate().first, creature->getCoordinate().second);
-
-        if (teamId == 1) {
-            auto iter = team1.cbegin(); // указатель на первый элемент
-            this->team1.erase(iter + index);
-
-            if (team1.empty()) {
-                cout << "Человечество победило";
-                coutInfoAboutTeam(team2, "Выжившие");
-                gameOver();
-            }
+        for (int x = x0; x < x1; x++) {
+            fill(&grid.at(x, y0), &grid.at(x, y0) + (y1 - y0), 0);
         }
-        else {
-            auto iter = team2.cbegin(); // указатель на первый элемент
-            this->team2.erase(iter + index);
 
-            if (team2.empty()) {
-                cout << "Зверяки победили";
-                coutInfoAboutTeam(team1, "Выжившие");
-                gameOver();
+        for (int blockX = x0 / ROOM_BLOCK; blockX <= (x1 - 1) / ROOM_BLOCK; blockX++)
+        {
+            for (int blockY = y0 / ROOM_BLOCK; blockY <= (y1 - 1) / ROOM_BLOCK; blockY++)
+            {
+                // Клетки блока в этой плитке, кроме края поля
+                int cellX0 = max({ x0, blockX * ROOM_BLOCK, 1 }), cellX1 = min({ x1, (blockX + 1) * ROOM_BLOCK, rows - 1 }) - 1;
+                int cellY0 = max({ y0, blockY * ROOM_BLOCK, 1 }), cellY1 = min({ y1, (blockY + 1) * ROOM_BLOCK, cols - 1 }) - 1;
+
+                auto paint = [&](int paintX0, int paintX1, int paintY0, int paintY1) {
+                    for (int x = max(paintX0, cellX0); x <= min(paintX1, cellX1); x++)
+                        for (int y = max(paintY0, cellY0); y <= min(paintY1, cellY1); y++)
+                            grid.at(x, y) = 1;
+                };
+
+                int roomX0, roomX1, roomY0, roomY1;
+                getRoom(blockX, blockY, roomX0, roomX1, roomY0, roomY1);
+                paint(roomX0, roomX1, roomY0, roomY1);
+
+                paintCorridor(blockX, blockY, blockX, blockY + 1, paint);
+                paintCorridor(blockX, blockY - 1, blockX, blockY, paint);
+                paintCorridor(blockX, blockY, blockX + 1, blockY, paint);
+                paintCorridor(blockX - 1, blockY, blockX, blockY, paint);
             }
         }
     }
 
-    void coutInfoAboutTeam(vector<Creature*> team, string title)
+    static int findLocal(vector<uint16_t>& local, int cell)
     {
-        cout << std::endl;
-        cout << title << std::endl;
-
-        for (int i = 0; i < team.size(); i++)
+        while (local[cell] != cell)
         {
-            cout << "Имя: " << team[i]->getName() << " " << "Хп: " << team[i]->getHp() << std::endl;
+            local[cell] = local[local[cell]];
+            cell = local[cell];
         }
+
+        return cell;
     }
 
-    void gameOver()
+    int tileIndex(int x, int y)
     {
-        cout << "\nGame over!" << endl;
-        isGame = false;
+        return x / tileSize * ((cols + tileSize - 1) / tileSize) + y / tileSize;
     }
 
-    void stepDamageEnemy(Creature* creature, vector<Creature*> enemies)
+    // Разметка внутри плитки на своём массиве родителей в нумерации плитки: свободные
+    // клетки подряд в строке сразу получают родителем первую клетку отрезка, а с
+    // отрезками строки выше отрезок связывается один раз на каждое касание (с
+    // диагоналями). Затем каждая клетка получает номер своего корня в tileLabels
+    void labelTile(Grid& grid, int x0, int x1, int y0, int y1)
     {
-        Creature* nearestEnemy;
-        int countEnemies = enemies.size();
-        int index;
+        int width = y1 - y0;
+        vector<uint16_t> local((size_t)(x1 - x0) * width);
+        // Отрезки строки как [начало, конец) по столбцам плитки
+        vector<pair<int, int>> previous, current;
 
-        nearestEnemy = this->area->findEnemy(creature, enemies);
-        if (nearestEnemy != NULL)
+        for (int x = x0; x < x1; x++)
         {
-            index = getIndexEnemy(nearestEnemy, enemies);
+            int rowStart = (x - x0) * width;
+            const uint8_t* row = &grid.cells[(size_t)x * cols + y0];
+            current.clear();
 
-            creature->attack(nearestEnemy);
+            for (int y = 0; y < width;)
+            {
+                if (!row[y]) {
+                    y++;
+                    continue;
+                }
 
-            if (!nearestEnemy->isAlive())
+                int begin = y;
+                for (; y < width && row[y]; y++) {
+                    local[rowStart + y] = (uint16_t)(rowStart + begin);
+                }
+                current.push_back({ begin, y });
+            }
+
+            // Отрезки [b, e) и [pb, pe) соседних строк касаются, если pb <= e и pe >= b
+            size_t first = 0;
+            for (size_t i = 0; i < current.size(); i++)
+            {
+                while (first < previous.size() && previous[first].second < current[i].first) {
+                    first++;
+                }
+
+                for (size_t k = first; k < previous.size() && previous[k].first <= current[i].second; k++)
+                {
+                    int a = findLocal(local, rowStart + current[i].first);
+                    int b = findLocal(local, rowStart - width + previous[k].first);
+                    local[max(a, b)] = (uint16_t)min(a, b);
+                }
+            }
+
+            swap(previous, current);
+        }
+
+        // Родитель меньше клетки, поэтому к её очереди он уже хранит номер корня
+        vector<int32_t>& roots = tileRootCells[tileIndex(x0, y0)];
+        for (int x = x0; x < x1; x++)
+        {
+            int rowStart = (x - x0) * width;
+            size_t cellStart = (size_t)x * cols + y0;
+
+            for (int y = 0; y < width; y++)
+            {
+                if (!grid.cells[cellStart + y]) {
+                    continue;
+                }
+
+                int cell = rowStart + y;
+                if (local[cell] == cell) {
+                    roots.push_back((int32_t)(cellStart + y));
+                    local[cell] = (uint16_t)roots.size();
+                }
+                else {
+                    local[cell] = local[local[cell]];
+                }
+                tileLabels[cellStart + y] = local[cell];
+            }
+        }
+    }
+
+    int32_t rootOf(size_t cell)
+    {
+        int x = (int)(cell / cols), y = (int)(cell % cols);
+        return rootsBefore[tileIndex(x, y)] + tileLabels[cell] - 1;
+    }
+
+    int32_t find(int32_t root)
+    {
+        while (parent[root] != root)
+        {
+            parent[root] = parent[parent[root]];
+            root = parent[root];
+        }
+
+        return root;
+    }
+
+    void unite(int32_t a, int32_t b)
+    {
+        a = find(a);
+        b = find(b);
+        if (a == b) {
+            return;
+        }
+
+        if (rootCell[a] < rootCell[b]) {
+            parent[b] = a;
+        }
+        else {
+            parent[a] = b;
+        }
+    }
+
+    // Сшивка плиток: соседи, уже пройденные при обходе строками (слева, сверху-слева,
+    // сверху, сверху-справа), для клеток у верхнего, левого и правого края плитки,
+    // где сосед может лежать в другой плитке
+    void mergeTiles(Grid& grid)
+    {
+        int tileCount = (int)tileRootCells.size();
+        rootsBefore.assign(tileCount + 1, 0);
+        for (int t = 0; t < tileCount; t++) {
+            rootsBefore[t + 1] = rootsBefore[t] + (int)tileRootCells[t].size();
+        }
+
+        parent.resize(rootsBefore[tileCount]);
+        rootCell.resize(rootsBefore[tileCount]);
+        for (int t = 0; t < tileCount; t++)
+        {
+            for (int k = 0; k < (int)tileRootCells[t].size(); k++)
+            {
+                parent[rootsBefore[t] + k] = rootsBefore[t] + k;
+                rootCell[rootsBefore[t] + k] = tileRootCells[t][k];
+            }
+        }
+        tileRootCells = vector<vector<int32_t>>();
+
+        static const int dx[] = { 0, -1, -1, -1 };
+        static const int dy[] = { -1, -1, 0, 1 };
+        auto merge = [&](int x, int y) {
+            size_t cell = (size_t)x * cols + y;
+            if (!grid.cells[cell]) {
+                return;
+            }
+
+            for (int k = 0; k < 4; k++)
+            {
+                int nx = x + dx[k], ny = y + dy[k];
+                if (nx >= 0 && ny >= 0 && ny < cols && grid.at(nx, ny)) {
+                    unite(rootOf(cell), rootOf((size_t)nx * cols + ny));
+                }
+            }
+        };
+
+        for (int x = 0; x < rows; x++)
+        {
+            if (x % tileSize == 0) {
+                for (int y = 0; y < cols; y++) {
+                    merge(x, y);
+                }
+                continue;
+            }
+
+            for (int y0 = 0; y0 < cols; y0 += tileSize)
             {
-                this->area->clearPosition(nearestEnemy->getCoordinate().first, nearestEnemy->getCoordinate().second);
+                merge(x, y0);
+                merge(x, min(y0 + tileSize, cols) - 1);
+            }
+        }
+    }
+
+    // Корни множеств получают номера областей по порядку плиток и строк в плитке,
+    // затем каждая клетка берёт номер по корню своей плитки. Номер пишется прямо
+    // в tileLabels, если областей меньше 65536, иначе — в отдельный массив int32_t
+    void numberRegions(Grid& grid, Terrain& terrain)
+    {
+        int rootCount = (int)parent.size();
+        vector<int32_t> regionOf(rootCount, 0);
+        int regionCount = 0;
+
+        for (int r = 0; r < rootCount; r++)
+        {
+            if (find(r) == r) {
+                regionOf[r] = ++regionCount;
             }
+        }
+        for (int r = 0; r < rootCount; r++) {
+            regionOf[r] = regionOf[find(r)];
+        }
+
+        terrain.regionCount = regionCount;
+        parent = vector<int32_t>();
+        rootCell = vector<int32_t>();
+
+        bool isNarrow = regionCount <= UINT16_MAX;
+        if (!isNarrow) {
+            terrain.regions.wide.assign((size_t)rows * cols, 0);
+        }
+
+        forEachTile([&](int x0, int x1, int y0, int y1) {
+            int before = rootsBefore[tileIndex(x0, y0)];
+            for (int x = x0; x < x1; x++)
+                for (int y = y0; y < y1; y++)
+                {
+                    size_t cell = (size_t)x * cols + y;
+                    int region = tileLabels[cell] ? regionOf[before + tileLabels[cell] - 1] : 0;
+                    if (isNarrow) {
+                        tileLabels[cell] = (uint16_t)region;
+                    }
+                    else {
+                        terrain.regions.wide[cell] = region;
+                    }
+                }
+        });
+
+        if (isNarrow) {
+            terrain.regions.narrow = move(tileLabels);
+        }
+        tileLabels = vector<uint16_t>();
+    }
+};
+
+enum CreatureNames
+{
+    wolf,
+    bear,
+    barbarian,
+    pathfinder,
+};
+
+class CreatureBuilder
+{
+public:
+    Creature* initCreature(CreatureNames creatureName, string name, int teamId)
+    {
+        switch (creatureName)
+        {
+        case wolf: return new Wolf(name, teamId);
+        case bear: return new Bear(name, teamId);
+        case barbarian: return new Barbarian(name, teamId);
+        case pathfinder: return new Pathfinder(name, teamId);
+        }
+
+        return NULL;
+    }
+
+    CreatureProfile getProfile(CreatureNames creatureName)
+    {
+        Creature* creature = initCreature(creatureName, getTypeName(creatureName), 0);
+        CreatureProfile profile = creature->getProfile();
+        delete creature;
+        return profile;
+    }
 
-            //Может работать не корректно и мб стоит это убрать
-            stepCheckStatusCreatures();
+    string getTypeName(CreatureNames creatureName)
+    {
+        switch (creatureName)
+        {
+        case wolf: return "wolf";
+        case bear: return "bear";
+        case barbarian: return "barbarian";
+        case pathfinder: return "pathfinder";
         }
+
+        return "";
     }
 
-    int getIndexEnemy(Creature* creature, vector<Creature*> enemies)
+    bool findByTypeName(string typeName, CreatureNames& creatureName)
     {
-        for (int i = 0; i < enemies.size(); i++)
+        CreatureNames all[] = { wolf, bear, barbarian, pathfinder };
+        for (int i = 0; i < 4; i++)
         {
-            if (enemies[i] == creature)
+            if (getTypeName(all[i]) == typeName)
             {
-                return i;
+                creatureName = all[i];
+                return true;
             }
         }
+
+        return false;
     }
 };
 
-int main()
+// Описание одного боя: составы команд, размер поля, зерно и лимит раундов
+struct Scenario
 {
-    setlocale(LC_ALL, "Russian");
-    srand(time(0));
+    vector<CreatureNames> team1;
+    vector<CreatureNames> team2;
+    int areaSize = 10;
+    unsigned int seed = 0;
+    int maxRounds = 1000;
+    map<CreatureNames, CreatureOverride> overrides;
+    TerrainNames terrain = field;
+};
+
+// 2 медведя и 4 волка против 2 варваров и 2 следопытов
+Scenario defaultScenario()
+{
+    Scenario scenario;
+    scenario.team1 = vector<CreatureNames>{ bear, bear, wolf, wolf, wolf, wolf };
+    scenario.team2 = vector<CreatureNames>{ barbarian, barbarian, pathfinder, pathfinder };
+    scenario.seed = (unsigned int)time(0);
+    return scenario;
+}
+
+// Счётчики движения за бой: сколько раз существа шли к цели, сколько из этих ходов
+// прокладывали маршрут впервые (первый ход, новая цель у стоявшего), сколько
+// выбросили старый маршрут и строили заново и сколько упёрлись в занятую клетку и встали
+struct MovementStats
+{
+    long long moves = 0;
+    long long plans = 0;
+    long long replans = 0;
+    long long blocked = 0;
+};
+
+struct BattleResult
+{
+    unsigned int seed;
+    // 0 — ничья, бой упёрся в лимит раундов
+    int winnerTeamId;
+    int rounds;
+    vector<pair<string, int>> survivors;
+    MovementStats movement;
+};
+
+// Бой как возобновляемая задача: корутина засыпает после каждого раунда battle()
+class BattleTask
+{
+public:
+    struct promise_type
+    {
+        exception_ptr exception;
+
+        BattleTask get_return_object()
+        {
+            return BattleTask(coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        suspend_always initial_suspend() { return {}; }
+        suspend_always final_suspend() noexcept { return {}; }
+        suspend_always yield_value(int) { return {}; }
+        void return_void() {}
+
+        void unhandled_exception()
+        {
+            this->exception = current_exception();
+        }
+    };
+
+    BattleTask() : handle(NULL) {}
+
+    BattleTask(BattleTask&& other) noexcept : handle(other.handle)
+    {
+        other.handle = NULL;
+    }
+
+    BattleTask& operator=(BattleTask&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle) { handle.destroy(); }
+            handle = other.handle;
+            other.handle = NULL;
+        }
+
+        return *this;
+    }
+
+    ~BattleTask()
+    {
+        if (handle) { handle.destroy(); }
+    }
+
+    // Проигрывает очередной раунд. Возвращает false, когда бой закончен
+    bool resume()
+    {
+        if (!handle || handle.done()) {
+            return false;
+        }
+
+        handle.resume();
+
+        if (handle.promise().exception) {
+            rethrow_exception(handle.promise().exception);
+        }
+
+        return !handle.done();
+    }
+
+private:
+    coroutine_handle<promise_type> handle;
+
+    explicit BattleTask(coroutine_handle<promise_type> handle) : handle(handle) {}
+};
+
+// Состав команды. Живые лежат подряд и отдаются как span без копирования.
+// Каждое существо получает handle — номер, который не меняется до конца боя;
+// по нему индексная карта даёт позицию в массиве, поэтому погибший убирается
+// обменом с последним за O(1). Порядок живых при этом меняется
+class Roster
+{
+public:
+    void add(Creature* creature)
+    {
+        creature->setRosterHandle((int)indexByHandle.size());
+        indexByHandle.push_back((int)alive.size());
+        alive.push_back(creature);
+    }
+
+    void remove(Creature* creature)
+    {
+        int handle = creature->getRosterHandle();
+        if (handle < 0 || handle >= (int)indexByHandle.size() || indexByHandle[handle] < 0) {
+            return;
+        }
+
+        int index = indexByHandle[handle];
+        Creature* last = alive.back();
+
+        alive[index] = last;
+        indexByHandle[last->getRosterHandle()] = index;
+        alive.pop_back();
+        indexByHandle[handle] = -1;
+    }
+
+    span<Creature* const> view() const
+    {
+        return span<Creature* const>(alive);
+    }
+
+    bool empty() const
+    {
+        return alive.empty();
+    }
+
+private:
+    vector<Creature*> alive;
+    // indexByHandle[handle] — позиция в alive, -1 — существо убрано
+    vector<int> indexByHandle;
+};
+
+struct AuctionCandidate
+{
+    int object;
+    int64_t benefit;
+};
+
+// Аукцион Бертсекаса для распределения участников по объектам с вместимостью.
+// Объект j даёт capacity[j] мест, каждое место продаётся отдельно. Кроме мест у
+// каждого есть запасной вариант overflowBenefit — на него уходят, когда все места
+// слишком подорожали. Ставки делаются по Якоби: все свободные участники считают
+// ставку одновременно по одним и тем же ценам (эта часть делится между потоками),
+// затем каждое место достаётся наибольшей ставке. Шаг ставки EPSILON = 1: каждый
+// получает вариант не хуже своего лучшего на 1, так что сумма отстаёт от оптимума
+// не больше чем на число участников. Точный ответ (выгоды, умноженные на число
+// участников) стоил бы долгих торгов между равноценными целями
+class AuctionAssigner
+{
+public:
+    AuctionAssigner(int threadCount = (int)thread::hardware_concurrency())
+    {
+        this->threadCount = max(threadCount, 1);
+    }
+
+    // Номер объекта для каждого участника, -1 — запасной вариант или кандидатов нет
+    vector<int> assign(const vector<vector<AuctionCandidate>>& candidates, const vector<int>& capacity, int64_t overflowBenefit)
+    {
+        int persons = (int)candidates.size();
+        int objects = (int)capacity.size();
+        isParallel = persons >= PARALLEL_MIN_PERSONS;
+
+        vector<int> slotStart(objects + 1, 0);
+        for (int j = 0; j < objects; j++) {
+            slotStart[j + 1] = slotStart[j] + max(capacity[j], 1);
+        }
+        int slotCount = slotStart[objects];
+
+        vector<int64_t> price(slotCount, 0);
+        vector<int> slotOwner(slotCount, -1);
+        vector<int> personSlot(persons);
+        vector<int> cheapest(objects);
+        vector<int64_t> cheapestPrice(objects), secondPrice(objects);
+        vector<int> bidSlot(persons);
+        vector<int64_t> bidValue(persons);
+        vector<int64_t> slotBid(slotCount, INT64_MIN);
+        vector<int> slotBidder(slotCount, -1);
+
+        vector<int> unassigned;
+        for (int i = 0; i < persons; i++)
+        {
+            personSlot[i] = candidates[i].empty() ? OVERFLOW_SLOT : -1;
+            if (!candidates[i].empty()) {
+                unassigned.push_back(i);
+            }
+        }
+
+        while (!unassigned.empty())
+        {
+            forEachChunk(objects, [&](int from, int to) {
+                for (int j = from; j < to; j++)
+                {
+                    cheapest[j] = slotStart[j];
+                    cheapestPrice[j] = secondPrice[j] = INT64_MAX / 4;
+
+                    for (int s = slotStart[j]; s < slotStart[j + 1]; s++)
+                    {
+                        if (price[s] < cheapestPrice[j]) {
+                            secondPrice[j] = cheapestPrice[j];
+                            cheapestPrice[j] = price[s];
+                            cheapest[j] = s;
+                        }
+                        else if (price[s] < secondPrice[j]) {
+                            secondPrice[j] = price[s];
+                        }
+                    }
+                }
+            });
+
+            forEachChunk((int)unassigned.size(), [&](int from, int to) {
+                for (int u = from; u < to; u++)
+                {
+                    int person = unassigned[u];
+                    int64_t best = overflowBenefit, second = INT64_MIN / 4;
+                    int bestSlot = OVERFLOW_SLOT;
+
+                    auto offer = [&](int64_t value, int slot) {
+                        if (value > best) {
+                            second = best;
+                            best = value;
+                            bestSlot = slot;
+                        }
+                        else if (value > second) {
+                            second = value;
+                        }
+                    };
+
+                    for (int k = 0; k < (int)candidates[person].size(); k++)
+                    {
+                        const AuctionCandidate& candidate = candidates[person][k];
+                        offer(candidate.benefit - cheapestPrice[candidate.object], cheapest[candidate.object]);
+                        offer(candidate.benefit - secondPrice[candidate.object], -1);
+                    }
+
+                    bidSlot[person] = bestSlot;
+                    bidValue[person] = bestSlot >= 0 ? price[bestSlot] + best - second + EPSILON : 0;
+                }
+            });
+
+            // Равные ставки достаются меньшему номеру — результат не зависит от потоков
+            vector<int> touched;
+            for (int u = 0; u < (int)unassigned.size(); u++)
+            {
+                int person = unassigned[u];
+                int slot = bidSlot[person];
+
+                if (slot == OVERFLOW_SLOT) {
+                    personSlot[person] = OVERFLOW_SLOT;
+                    continue;
+                }
+
+                if (slotBidder[slot] == -1) {
+                    touched.push_back(slot);
+                }
+                if (bidValue[person] > slotBid[slot]) {
+                    slotBid[slot] = bidValue[person];
+                    slotBidder[slot] = person;
+                }
+            }
+
+            vector<int> outbid;
+            for (int u = 0; u < (int)unassigned.size(); u++)
+            {
+                int person = unassigned[u];
+                int slot = bidSlot[person];
+                if (slot != OVERFLOW_SLOT && slotBidder[slot] != person) {
+                    outbid.push_back(person);
+                }
+            }
+
+            for (int t = 0; t < (int)touched.size(); t++)
+            {
+                int slot = touched[t];
+                if (slotOwner[slot] != -1) {
+                    personSlot[slotOwner[slot]] = -1;
+                    outbid.push_back(slotOwner[slot]);
+                }
+
+                slotOwner[slot] = slotBidder[slot];
+                personSlot[slotBidder[slot]] = slot;
+                price[slot] = slotBid[slot];
+
+                slotBid[slot] = INT64_MIN;
+                slotBidder[slot] = -1;
+            }
+
+            sort(outbid.begin(), outbid.end());
+            unassigned = move(outbid);
+        }
+
+        vector<int> slotObject(slotCount);
+        for (int j = 0; j < objects; j++) {
+            fill(slotObject.begin() + slotStart[j], slotObject.begin() + slotStart[j + 1], j);
+        }
+
+        vector<int> result(persons, -1);
+        for (int i = 0; i < persons; i++)
+        {
+            if (personSlot[i] >= 0) {
+                result[i] = slotObject[personSlot[i]];
+            }
+        }
+
+        return result;
+    }
+
+private:
+    // Меньше этого раздача задач пулу не окупается — аукцион идёт на вызывающем потоке
+    static const int PARALLEL_MIN_PERSONS = 4096;
+    static const int CHUNK_SIZE = 1024;
+    static const int OVERFLOW_SLOT = -2;
+    static const int EPSILON = 1;
+
+    int threadCount;
+    bool isParallel;
+
+    template <class ChunkFunction>
+    void forEachChunk(int count, ChunkFunction function)
+    {
+        int chunkCount = (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+        ParallelPool::shared().forEach(chunkCount, isParallel ? threadCount : 1, [&](int c) {
+            function(c * CHUNK_SIZE, min((c + 1) * CHUNK_SIZE, count));
+        });
+    }
+};
+
+// Маршрут существа во времени: cells[k] — клетка в тик startTick + k.
+// Тик — один шаг: раунд r занимает тики r * maxSpeed .. (r + 1) * maxSpeed, существо
+// со скоростью v двигается только в первые v тиков раунда, остальные стоит на месте.
+// Маршрут всегда начинается в начале раунда
+struct MovePlan
+{
+    int targetCell;
+    int startTick;
+    vector<int> cells;
+};
+
+class Area {
+private:
+    int N;
+    vector<Creature*> teamA;
+    vector<Creature*> teamB;
+    Grid map;
+    RegionMap regions;
+    // Область, где расставляются все существа, — чтобы каждый мог дойти до врага
+    int battleRegion;
+    TerrainNames terrainName;
+    unsigned int seed;
+
+    // Кто стоит в клетке; map при этом помечает клетку занятой
+    vector<Creature*> occupants;
+    // Существа ходят по очереди, и весь свой путь за раунд каждое проходит в свой ход.
+    // Поэтому остальные в этот момент стоят либо там, где начали раунд, либо там, где
+    // его закончат: эти клетки маршрут держит весь раунд — (раунд, клетка) -> чей маршрут.
+    // Клетки, через которые только проходят, считаются отдельно: в них нельзя
+    // закончить раунд, пока кто-то ещё может через них пройти
+    unordered_map<uint64_t, Creature*> reservations;
+    unordered_map<uint64_t, int> transits;
+    // Кто останется стоять в клетке после конца своего маршрута и с какого раунда
+    vector<Creature*> parkedBy;
+    vector<int> parkedFrom;
+    unordered_map<Creature*, MovePlan> plans;
+    int maxSpeed = 1;
+    MovementStats movementStats;
+
+    // Назначение целей на раунд по положению на его начало: кого бьёт существо
+    // и его ближайшие по пути враги — запас, если цель погибнет раньше его хода
+    unordered_map<Creature*, Creature*> assignedTargets;
+    unordered_map<Creature*, vector<Creature*>> candidateTargets;
+    AuctionAssigner assigner;
+
+    static const int TARGET_CANDIDATES = 4;
+    static const int MAX_ATTACKERS_PER_TARGET = 8;
+    // Шаг аукциона — 1, так что цена шага и надбавка прошлой цели заметно больше
+    static const int STEP_COST = 4;
+    static const int INCUMBENT_BONUS = 2;
+    // Метки обхода: до TARGET_CANDIDATES врагов с расстоянием на клетку
+    vector<Creature*> labelTarget;
+    vector<int> labelDistance;
+    vector<uint8_t> labelCount;
+
+    // Буферы поиска переиспользуются между вызовами
+    vector<int> searchQueue;
+
+    struct SearchNode
+    {
+        int cell;
+        int tick;
+        int parent;
+    };
+    vector<SearchNode> searchNodes;
+    // Посещённые тики окна по клеткам: бит k — тик startTick + k
+    vector<uint64_t> searchVisited;
+    vector<int> searchStamp;
+    int currentSearch = 0;
+    // Обратный поиск от цели текущего планирования: расстояние по рельефу, найдено ли
+    // оно в этом поиске и окончательно ли. Оценка f = g + h не убывает, поэтому очередь —
+    // корзины по f; внутри корзины первым идёт последний добавленный, то есть самый глубокий
+    vector<int> targetDistance;
+    vector<int> targetStamp;
+    vector<int> targetClosed;
+    vector<vector<int>> targetBuckets;
+    int targetBucket = 0;
+    int targetStart = 0;
+    // На карте без стен прямая оценка и так точна, обход не нужен
+    bool hasWalls = false;
+
+    // Окно планирования — два целых раунда, но не больше битов маски; дальше маршрут
+    // достраивается заново
+    int windowTicks() { return maxSpeed <= 63 ? min(2, 63 / maxSpeed) * maxSpeed : 63; }
+    static const int maxExpansions = 4096;
+
+    void generateMap()
+    {
+        Terrain terrain = TerrainGenerator().generate(terrainName, N, N, seed);
+        battleRegion = terrain.findLargestRegion();
+
+        // Область 0 — это стены, в них никого не поставить
+        int freeCells = 0;
+        for (size_t i = 0; i < terrain.regions.size() && battleRegion != 0; i++) {
+            freeCells += terrain.regions[i] == battleRegion;
+        }
+
+        // Если все не помещаются в одну область, бой идёт на пустом поле
+        if (freeCells < (int)(teamA.size() + teamB.size())) {
+            terrain = TerrainGenerator().generate(field, N, N, seed);
+            battleRegion = terrain.findLargestRegion();
+        }
+
+        this->map = move(terrain.grid);
+        this->regions = move(terrain.regions);
+        this->hasWalls = find(this->map.cells.begin(), this->map.cells.end(), 0) != this->map.cells.end();
+
+        this->occupants.assign(this->map.cells.size(), NULL);
+        this->parkedBy.assign(this->map.cells.size(), NULL);
+        this->parkedFrom.assign(this->map.cells.size(), INT_MAX);
+        this->searchVisited.assign(this->map.cells.size(), 0);
+        this->searchStamp.assign(this->map.cells.size(), 0);
+        this->targetDistance.assign(this->map.cells.size(), 0);
+        this->targetStamp.assign(this->map.cells.size(), 0);
+        this->targetClosed.assign(this->map.cells.size(), 0);
+    }
+
+    bool isPlaceFree(int posX, int posY)
+    {
+        return map.at(posX, posY) == 1 && regions[(size_t)posX * N + posY] == battleRegion;
+    }
+
+    void generatePositionForHeroes()
+    {
+        for (int i = 0; i < this->teamA.size(); i++)
+        {
+            bool isSetPosition = false;
+
+            while (!isSetPosition)
+            {
+                int posX = rollDice(N) - 1;
+                int posY = rollDice(N) - 1;
+
+                if (isPlaceFree(posX, posY))
+                {
+                    map.at(posX, posY) = 0;
+                    occupants[posX * N + posY] = teamA[i];
+                    teamA[i]->setCoordinate(posX, posY);
+                    isSetPosition = true;
+                }
+            }
+        }
+
+        for (int i = 0; i < teamB.size(); i++)
+        {
+            bool isSetPosition = false;
+
+            while (!isSetPosition)
+            {
+                int posX = rollDice(N) - 1;
+                int posY = rollDice(N) - 1;
+
+                if (isPlaceFree(posX, posY))
+                {
+                    map.at(posX, posY) = 0;
+                    occupants[posX * N + posY] = teamB[i];
+                    teamB[i]->setCoordinate(posX, posY);
+                    isSetPosition = true;
+                }
+            }
+        }
+    }
+
+    int cellOf(Creature* creature)
+    {
+        pair<int, int> coordinate = creature->getCoordinate();
+        return coordinate.first * N + coordinate.second;
+    }
+
+    int distance(int cellA, int cellB)
+    {
+        return max(abs(cellA / N - cellB / N), abs(cellA % N - cellB % N));
+    }
+
+    static uint64_t reservationKey(int round, int cell)
+    {
+        return ((uint64_t)round << 32) | (uint32_t)cell;
+    }
+
+    Creature* reservedBy(int round, int cell)
+    {
+        auto found = reservations.find(reservationKey(round, cell));
+        return found == reservations.end() ? NULL : found->second;
+    }
+
+    bool isTransit(int round, int cell)
+    {
+        return transits.count(reservationKey(round, cell)) != 0;
+    }
+
+    // Раунд, в котором делается шаг, приводящий в клетку в тик tick
+    int roundOfStep(int tick)
+    {
+        return (tick - 1) / maxSpeed;
+    }
+
+    // Обходит клетки маршрута по раундам: isHeld — клетка, где существо начинает
+    // или заканчивает раунд; если маршрут кончился посреди раунда, там оно и стоит
+    void forEachPlanCell(const MovePlan& plan, function<void(int round, int cell, bool isHeld)> onCell)
+    {
+        int lastTick = plan.startTick + (int)plan.cells.size() - 1;
+        int firstRound = plan.startTick / maxSpeed;
+
+        for (int round = firstRound; round <= max(firstRound, roundOfStep(lastTick)); round++)
+        {
+            int from = max(round * maxSpeed, plan.startTick);
+            int to = min((round + 1) * maxSpeed, lastTick);
+
+            for (int tick = from; tick <= to; tick++) {
+                onCell(round, plan.cells[tick - plan.startTick], tick == from || tick == to);
+            }
+        }
+    }
+
+    // Один обход в ширину сразу от всех врагов команды teamId: каждая клетка собирает
+    // до TARGET_CANDIDATES ближайших по пути врагов вместе с расстоянием.
+    // Существа команды получают метки, но путь через них, как и через врагов, не идёт
+    void buildCandidateLabels(int teamId)
+    {
+        labelTarget.assign(map.cells.size() * TARGET_CANDIDATES, NULL);
+        labelDistance.assign(map.cells.size() * TARGET_CANDIDATES, 0);
+        labelCount.assign(map.cells.size(), 0);
+        // В очереди номера меток: клетка * TARGET_CANDIDATES + место в клетке
+        searchQueue.clear();
+
+        for (int cell = 0; cell < (int)occupants.size(); cell++)
+        {
+            if (occupants[cell] != NULL && occupants[cell]->getTeamId() != teamId) {
+                labelTarget[cell * TARGET_CANDIDATES] = occupants[cell];
+                labelCount[cell] = 1;
+                searchQueue.push_back(cell * TARGET_CANDIDATES);
+            }
+        }
+
+        for (size_t head = 0; head < searchQueue.size(); head++)
+        {
+            int label = searchQueue[head];
+            int x = label / TARGET_CANDIDATES / N;
+            int y = label / TARGET_CANDIDATES % N;
+
+            for (int k = 0; k < 8; k++)
+            {
+                int nextX = x + row[k];
+                int nextY = y + col[k];
+                if (!map.isInside(nextX, nextY)) {
+                    continue;
+                }
+
+                int next = nextX * N + nextY;
+                bool isFree = map.cells[next] == 1;
+                bool isAlly = occupants[next] != NULL && occupants[next]->getTeamId() == teamId;
+                if ((!isFree && !isAlly) || labelCount[next] == TARGET_CANDIDATES) {
+                    continue;
+                }
+
+                bool isKnown = false;
+                for (int i = 0; i < labelCount[next]; i++) {
+                    isKnown |= labelTarget[next * TARGET_CANDIDATES + i] == labelTarget[label];
+                }
+                if (isKnown) {
+                    continue;
+                }
+
+                int nextLabel = next * TARGET_CANDIDATES + labelCount[next]++;
+                labelTarget[nextLabel] = labelTarget[label];
+                labelDistance[nextLabel] = labelDistance[label] + 1;
+
+                if (isFree) {
+                    searchQueue.push_back(nextLabel);
+                }
+            }
+        }
+    }
+
+    // Распределяет живых бойцов команды по врагам аукционом. Выгода — минус число шагов
+    // до удара (дальнему бою идти не нужно), прошлая цель чуть выгоднее, чтобы маршруты
+    // не перестраивались из-за равноценных вариантов. Враг принимает столько бойцов,
+    // сколько средних ударов команды нужно, чтобы его добить: лишние идут к другим
+    void assignTargets(int teamId)
+    {
+        vector<Creature*> attackers;
+        vector<Creature*> enemies;
+        unordered_map<Creature*, int> enemyIndex;
+
+        for (int side = 0; side < 2; side++)
+        {
+            vector<Creature*>& team = side == 0 ? teamA : teamB;
+            for (int i = 0; i < (int)team.size(); i++)
+            {
+                if (!team[i]->isAlive()) {
+                    continue;
+                }
+
+                if (team[i]->getTeamId() == teamId) {
+                    attackers.push_back(team[i]);
+                }
+                else {
+                    enemyIndex[team[i]] = (int)enemies.size();
+                    enemies.push_back(team[i]);
+                }
+            }
+        }
+
+        if (attackers.empty() || enemies.empty()) {
+            return;
+        }
+
+        buildCandidateLabels(teamId);
+
+        double averageDamage = 0;
+        for (int i = 0; i < (int)attackers.size(); i++)
+        {
+            CreatureProfile profile = attackers[i]->getProfile();
+            averageDamage += profile.weaponNumberDiceRoll * (profile.weaponMaxDiceNumber + 1) / 2.0 + profile.bonusAtack;
+        }
+        averageDamage /= attackers.size();
+
+        vector<int> capacity(enemies.size());
+        for (int j = 0; j < (int)enemies.size(); j++)
+        {
+            // Попадание бросает сам защищающийся со своим бонусом атаки (Creature::checkArmor);
+            // неуязвимому хватит и одной грани, чтобы вместимость осталась конечной
+            CreatureProfile enemyProfile = enemies[j]->getProfile();
+            int facesToHit = 21 - max(enemyProfile.armor - enemyProfile.bonusAtack, 1);
+            double hitChance = max(facesToHit, 1) / 20.0;
+            double hitsToKill = ceil(enemies[j]->getHp() / (hitChance * max(averageDamage, 1.0)));
+            capacity[j] = (int)min<double>(MAX_ATTACKERS_PER_TARGET, max(1.0, hitsToKill));
+        }
+
+        vector<vector<AuctionCandidate>> candidates(attackers.size());
+        int maxDistance = 1;
+
+        for (int i = 0; i < (int)attackers.size(); i++)
+        {
+            Creature* attacker = attackers[i];
+            int cell = cellOf(attacker);
+            Creature* previous = assignedTargets.count(attacker) ? assignedTargets[attacker] : NULL;
+            vector<Creature*>& nearest = candidateTargets[attacker];
+            nearest.clear();
+
+            for (int k = 0; k < labelCount[cell]; k++)
+            {
+                Creature* target = labelTarget[cell * TARGET_CANDIDATES + k];
+                int distance = labelDistance[cell * TARGET_CANDIDATES + k];
+                pair<int, int> targetCoordinate = target->getCoordinate();
+                int steps = attacker->getWeaponForBitEbalo(targetCoordinate.first, targetCoordinate.second) != NULL ? 0 : distance - 1;
+
+                candidates[i].push_back({ enemyIndex[target], -STEP_COST * steps + (target == previous ? INCUMBENT_BONUS : 0) });
+                nearest.push_back(target);
+                maxDistance = max(maxDistance, distance);
+            }
+        }
+
+        // Запасной вариант хуже любой настоящей цели: без места остаются, только когда мест нет
+        vector<int> assigned = assigner.assign(candidates, capacity, -STEP_COST * (maxDistance + 1));
+
+        for (int i = 0; i < (int)attackers.size(); i++) {
+            assignedTargets[attackers[i]] = assigned[i] >= 0 ? enemies[assigned[i]] : NULL;
+        }
+    }
+
+    // Нет ли в клетке в раунде round чужого существа: стоящего там весь раунд или с этого раунда
+    bool isHeldByOther(Creature* hero, int cell, int round)
+    {
+        Creature* owner = reservedBy(round, cell);
+        if (owner != NULL && owner != hero) {
+            return true;
+        }
+
+        return parkedBy[cell] != NULL && parkedBy[cell] != hero && parkedFrom[cell] <= round;
+    }
+
+    // Можно ли оказаться в клетке в тик tick. Существо без маршрута — неподвижное
+    // препятствие, с маршрутом — его положение знает таблица резервирования.
+    // Конец раунда — это и начало следующего, так что клетку проверяют оба
+    bool isCellFree(Creature* hero, int cell, int tick)
+    {
+        Creature* occupant = occupants[cell];
+        if (map.cells[cell] == 0 && occupant == NULL) {
+            return false;
+        }
+
+        if (occupant != NULL && occupant != hero && plans.count(occupant) == 0) {
+            return false;
+        }
+
+        int round = roundOfStep(tick);
+        if (isHeldByOther(hero, cell, round)) {
+            return false;
+        }
+
+        if (tick % maxSpeed != 0) {
+            return true;
+        }
+
+        // Планирующий свой маршрут уже отпустил, так что проходят здесь только другие
+        return !isHeldByOther(hero, cell, round + 1) && !isTransit(round, cell) && !isTransit(round + 1, cell);
+    }
+
+    // Остаться в клетке с тика tick до конца окна и после можно, если её не займёт
+    // никто другой и никто через неё не пройдёт
+    bool canPark(Creature* hero, int cell, int tick, int startTick, int windowEnd)
+    {
+        if (parkedBy[cell] != NULL && parkedBy[cell] != hero) {
+            return false;
+        }
+
+        int firstRound = tick == startTick ? startTick / maxSpeed : roundOfStep(tick);
+        for (int round = firstRound; round <= roundOfStep(windowEnd); round++)
+        {
+            if (isHeldByOther(hero, cell, round) || isTransit(round, cell)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Нижняя оценка числа тиков на steps шагов при скорости speed, начиная с тика tick
+    int ticksForSteps(int tick, int steps, int speed)
+    {
+        int offset = tick % maxSpeed;
+        int available = max(0, speed - offset);
+        if (steps <= available) {
+            return steps;
+        }
+
+        steps -= available;
+        int fullRounds = (steps - 1) / speed;
+        return maxSpeed - offset + fullRounds * maxSpeed + steps - fullRounds * speed;
+    }
+
+    void releasePlan(Creature* hero)
+    {
+        auto found = plans.find(hero);
+        if (found == plans.end()) {
+            return;
+        }
+
+        forEachPlanCell(found->second, [&](int round, int cell, bool isHeld) {
+            if (isHeld) {
+                reservations.erase(reservationKey(round, cell));
+            }
+            else if (--transits[reservationKey(round, cell)] == 0) {
+                transits.erase(reservationKey(round, cell));
+            }
+        });
+
+        MovePlan& plan = found->second;
+        int lastCell = plan.cells.back();
+        if (parkedBy[lastCell] == hero) {
+            parkedBy[lastCell] = NULL;
+            parkedFrom[lastCell] = INT_MAX;
+        }
+
+        plans.erase(found);
+    }
+
+    // Настоящее число шагов до цели по рельефу: прямая оценка загоняет A* в тупик
+    // за стеной, которую не обойти за окно. Считается обратным A* от цели к существу,
+    // который продолжается, только когда спросили ещё не закрытую клетку, — так
+    // обходится лишь то, что нужно прямому поиску. Существа не мешают — они сдвинутся,
+    // так что оценка остаётся нижней
+    void startTargetDistance(int targetCell, int start)
+    {
+        for (int f = targetBucket; f < (int)targetBuckets.size(); f++) {
+            targetBuckets[f].clear();
+        }
+
+        targetStart = start;
+        targetBucket = distance(targetCell, start);
+        targetStamp[targetCell] = currentSearch;
+        targetDistance[targetCell] = 0;
+        pushTargetCell(targetCell, targetBucket);
+    }
+
+    void pushTargetCell(int cell, int f)
+    {
+        if (f >= (int)targetBuckets.size()) {
+            targetBuckets.resize(f + 1);
+        }
+
+        targetBuckets[f].push_back(cell);
+    }
+
+    int targetDistanceOf(int cell)
+    {
+        while (targetClosed[cell] != currentSearch && targetBucket < (int)targetBuckets.size())
+        {
+            if (targetBuckets[targetBucket].empty()) {
+                targetBucket++;
+                continue;
+            }
+
+            int current = targetBuckets[targetBucket].back();
+            targetBuckets[targetBucket].pop_back();
+
+            // Клетку уже закрыли или потом нашли к ней путь короче
+            if (targetClosed[current] == currentSearch || targetDistance[current] + distance(current, targetStart) != targetBucket) {
+                continue;
+            }
+            targetClosed[current] = currentSearch;
+
+            int x = current / N;
+            int y = current % N;
+
+            for (int k = 0; k < 8; k++)
+            {
+                int nextX = x + row[k];
+                int nextY = y + col[k];
+                if (!map.isInside(nextX, nextY)) {
+                    continue;
+                }
+
+                int next = nextX * N + nextY;
+                int g = targetDistance[current] + 1;
+                if (map.cells[next] == 0 && occupants[next] == NULL) {
+                    continue;
+                }
+                if (targetStamp[next] == currentSearch && targetDistance[next] <= g) {
+                    continue;
+                }
+
+                targetStamp[next] = currentSearch;
+                targetDistance[next] = g;
+                pushTargetCell(next, g + distance(next, targetStart));
+            }
+        }
+
+        // Недостижимая клетка: дальше любой достижимой
+        return targetClosed[cell] == currentSearch ? targetDistance[cell] : (int)map.cells.size();
+    }
+
+    // Оконный кооперативный A* в пространстве-времени: ищет путь к клетке рядом с целью,
+    // не пересекаясь с чужими резервированиями. Если за окно не дойти, берёт самую близкую
+    // к цели достижимую клетку. Маршрут сразу резервируется
+    void planPath(Creature* hero, Creature* target, int startTick)
+    {
+        int start = cellOf(hero);
+        int targetCell = cellOf(target);
+        int speed = max(1, min(hero->getSpeed(), maxSpeed));
+        int windowEnd = startTick + windowTicks();
+
+        searchNodes.clear();
+        if (++currentSearch == INT_MAX) {
+            fill(searchStamp.begin(), searchStamp.end(), 0);
+            fill(targetStamp.begin(), targetStamp.end(), 0);
+            fill(targetClosed.begin(), targetClosed.end(), 0);
+            currentSearch = 1;
+        }
+
+        // Отмечает (клетка, тик) посещённой; false, если уже была
+        auto visit = [&](int cell, int tick) {
+            if (searchStamp[cell] != currentSearch) {
+                searchStamp[cell] = currentSearch;
+                searchVisited[cell] = 0;
+            }
+
+            uint64_t bit = (uint64_t)1 << (tick - startTick);
+            if (searchVisited[cell] & bit) {
+                return false;
+            }
+
+            searchVisited[cell] |= bit;
+            return true;
+        };
+
+        // (f, h, номер узла); равные оценки разрешаются порядком добавления
+        priority_queue<tuple<int, int, int>, vector<tuple<int, int, int>>, greater<tuple<int, int, int>>> open;
+
+        if (hasWalls) {
+            startTargetDistance(targetCell, start);
+        }
+
+        auto heuristic = [&](int cell, int tick) {
+            int steps = hasWalls ? targetDistanceOf(cell) : distance(cell, targetCell);
+            return ticksForSteps(tick, max(0, steps - 1), speed);
+        };
+
+        searchNodes.push_back({ start, startTick, -1 });
+        visit(start, startTick);
+        open.push({ heuristic(start, startTick), heuristic(start, startTick), 0 });
+
+        int bestNode = 0;
+        int bestH = INT_MAX;
+        int expansions = 0;
+
+        while (!open.empty() && expansions < maxExpansions)
+        {
+            auto [f, h, index] = open.top();
+            open.pop();
+            expansions++;
+
+            SearchNode node = searchNodes[index];
+            bool isGoal = node.cell != targetCell && distance(node.cell, targetCell) <= 1;
+            // Первый снятый с очереди узел на краю окна — лучший частичный путь
+            bool isFinal = isGoal || node.tick >= windowEnd;
+
+            if ((h < bestH || isFinal) && canPark(hero, node.cell, node.tick, startTick, windowEnd))
+            {
+                bestNode = index;
+                bestH = h;
+
+                if (isFinal) {
+                    break;
+                }
+            }
+
+            if (node.tick >= windowEnd) {
+                continue;
+            }
+
+            int x = node.cell / N;
+            int y = node.cell % N;
+            bool canMove = node.tick % maxSpeed < speed;
+
+            // k == 8 — остаться на месте
+            for (int k = 0; k <= 8; k++)
+            {
+                if (k < 8 && !canMove) {
+                    continue;
+                }
+
+                int nextX = k < 8 ? x + row[k] : x;
+                int nextY = k < 8 ? y + col[k] : y;
+                if (!map.isInside(nextX, nextY)) {
+                    continue;
+                }
+
+                int next = nextX * N + nextY;
+                int nextTick = node.tick + 1;
+                if (next == targetCell || !isCellFree(hero, next, nextTick)) {
+                    continue;
+                }
+
+                if (!visit(next, nextTick)) {
+                    continue;
+                }
+
+                int nextH = heuristic(next, nextTick);
+                searchNodes.push_back({ next, nextTick, index });
+                open.push({ nextTick - startTick + nextH, nextH, (int)searchNodes.size() - 1 });
+            }
+        }
+
+        MovePlan plan;
+        plan.targetCell = targetCell;
+        plan.startTick = startTick;
+
+        for (int index = bestNode; index != -1; index = searchNodes[index].parent)
+        {
+            plan.cells.push_back(searchNodes[index].cell);
+        }
+        reverse(plan.cells.begin(), plan.cells.end());
+
+        forEachPlanCell(plan, [&](int round, int cell, bool isHeld) {
+            if (isHeld) {
+                reservations[reservationKey(round, cell)] = hero;
+            }
+            else {
+                transits[reservationKey(round, cell)]++;
+            }
+        });
+
+        int lastCell = plan.cells.back();
+        int lastTick = startTick + (int)plan.cells.size() - 1;
+        parkedBy[lastCell] = hero;
+        parkedFrom[lastCell] = max(startTick / maxSpeed, roundOfStep(lastTick)) + 1;
+
+        plans[hero] = move(plan);
+    }
+
+    // Старый маршрут годится, пока существо идёт по нему и он ведёт к цели. Цель за это
+    // время сдвигается, а аукцион может дать соседнюю: пока маршрут не кончается в этом
+    // раунде, он годится, если его конец стал дальше от цели не больше чем на четверть
+    // пути до неё. Кончающийся маршрут должен привести прямо к цели
+    bool isPlanValid(Creature* hero, Creature* target, int roundTick)
+    {
+        auto found = plans.find(hero);
+        if (found == plans.end()) {
+            return false;
+        }
+
+        MovePlan& plan = found->second;
+        int index = roundTick - plan.startTick;
+        int cell = index < (int)plan.cells.size() ? plan.cells[index] : plan.cells.back();
+        if (cell != cellOf(hero)) {
+            return false;
+        }
+
+        int targetCell = cellOf(target);
+        int lastCell = plan.cells.back();
+        if (index + maxSpeed >= (int)plan.cells.size()) {
+            return lastCell != targetCell && distance(lastCell, targetCell) <= 1;
+        }
+
+        int drift = distance(lastCell, targetCell) - distance(lastCell, plan.targetCell);
+        return drift <= max(1, distance(cell, targetCell) / 4);
+    }
+
+    void moveTo(Creature* hero, int cell)
+    {
+        int current = cellOf(hero);
+        map.cells[current] = 1;
+        occupants[current] = NULL;
+
+        map.cells[cell] = 0;
+        occupants[cell] = hero;
+        hero->setCoordinate(cell / N, cell % N);
+    }
+
+public:
+    Area(int N, span<Creature* const> teamA, span<Creature* const> teamB, TerrainNames terrainName = field, unsigned int seed = 0)
+    {
+        this->N = N;
+        this->terrainName = terrainName;
+        this->seed = seed;
+        this->teamA.assign(teamA.begin(), teamA.end());
+        this->teamB.assign(teamB.begin(), teamB.end());
+
+        for (int i = 0; i < (int)this->teamA.size(); i++) {
+            maxSpeed = max(maxSpeed, this->teamA[i]->getSpeed());
+        }
+        for (int i = 0; i < (int)this->teamB.size(); i++) {
+            maxSpeed = max(maxSpeed, this->teamB[i]->getSpeed());
+        }
+
+        generateMap();
+        generatePositionForHeroes();
+    }
+
+    // Цель из назначения на раунд. Если она погибла раньше хода или места у целей
+    // кончились, берётся ближайший живой кандидат; дальний бой без кандидатов бьёт случайного
+    Creature* findEnemy(Creature* hero, span<Creature* const> enemies)
+    {
+        auto assigned = assignedTargets.find(hero);
+        if (assigned != assignedTargets.end() && assigned->second != NULL && assigned->second->isAlive()) {
+            return assigned->second;
+        }
+
+        vector<Creature*>& candidates = candidateTargets[hero];
+        for (int i = 0; i < (int)candidates.size(); i++)
+        {
+            if (candidates[i]->isAlive()) {
+                return candidates[i];
+            }
+        }
+
+        Creature* randEnemy = enemies[rollDice((int)enemies.size()) - 1];
+        if (hero->getWeaponForBitEbalo(randEnemy->getCoordinate().first, randEnemy->getCoordinate().second) != NULL)
+        {
+            return randEnemy;
+        }
+
+        // Без цели существо стоит на месте: старый маршрут не должен держать чужие клетки
+        releasePlan(hero);
+        return NULL;
+    }
+
+    // Ведёт существо к цели на расстояние удара, не дальше его скорости за раунд.
+    // Маршрут переиспользуется между раундами и строится заново, только если
+    // цель ушла от него далеко, окно кончилось или путь оказался занят
+    void moveTowards(Creature* hero, Creature* target, int round)
+    {
+        pair<int, int> targetCoordinate = target->getCoordinate();
+        if (hero->getWeaponForBitEbalo(targetCoordinate.first, targetCoordinate.second) != NULL)
+        {
+            // Дошедший стоит на месте и для остальных становится препятствием
+            releasePlan(hero);
+            return;
+        }
+
+        movementStats.moves++;
+
+        int roundTick = round * maxSpeed;
+        if (!isPlanValid(hero, target, roundTick))
+        {
+            if (plans.count(hero) != 0) {
+                movementStats.replans++;
+            }
+            else {
+                movementStats.plans++;
+            }
+
+            releasePlan(hero);
+            planPath(hero, target, roundTick);
+        }
+
+        MovePlan& plan = plans[hero];
+        for (int tick = roundTick + 1; tick <= roundTick + maxSpeed; tick++)
+        {
+            int index = tick - plan.startTick;
+            if (index >= (int)plan.cells.size()) {
+                break;
+            }
+
+            int next = plan.cells[index];
+            if (next == cellOf(hero)) {
+                continue;
+            }
+
+            // Клетку ещё не освободил тот, кто ходит позже в этом раунде
+            if (occupants[next] != NULL)
+            {
+                movementStats.blocked++;
+                releasePlan(hero);
+                return;
+            }
+
+            moveTo(hero, next);
+        }
+    }
+
+    // Назначает цели обеим командам, пока никто ещё не ходил
+    void beginRound()
+    {
+        assignTargets(1);
+        assignTargets(2);
+    }
+
+    MovementStats getMovementStats()
+    {
+        return movementStats;
+    }
+
+    void removeCreature(Creature* creature)
+    {
+        releasePlan(creature);
+        assignedTargets.erase(creature);
+        candidateTargets.erase(creature);
+
+        int cell = cellOf(creature);
+        this->map.cells[cell] = 1;
+        this->occupants[cell] = NULL;
+    }
+};
+
+class Game {
+public:
+    int round_count = 0;
+    int winnerTeamId = 0;
+    Scenario scenario;
+    Roster team1;
+    Roster team2;
+    map<Creature*, int> listIniciative;
+    vector<Creature*> turnOrder;
+    Area* area = NULL;
+
+    Game() : Game(defaultScenario()) {}
+
+    Game(Scenario scenario)
+    {
+        this->scenario = scenario;
+    }
+
+    Game(const Game&) = delete;
+    Game& operator=(const Game&) = delete;
+
+    ~Game()
+    {
+        for (int i = 0; i < (int)creatures.size(); i++)
+        {
+            delete creatures[i];
+        }
+
+        delete area;
+    }
+
+    void StartGame() {
+        InitializeGame();
+
+        game();
+    }
+
+    // Тот же game(), только бой отдаёт управление после каждого раунда
+    BattleTask play()
+    {
+        InitializeGame();
+
+        while (isGame && round_count < scenario.maxRounds)
+        {
+            battle();
+            round_count++;
+
+            co_yield round_count;
+        }
+    }
+
+    BattleResult getResult()
+    {
+        BattleResult result;
+        result.seed = scenario.seed;
+        result.winnerTeamId = winnerTeamId;
+        result.rounds = round_count;
+        if (area != NULL) {
+            result.movement = area->getMovementStats();
+        }
+
+        for (int i = 0; i < (int)creatures.size(); i++)
+        {
+            if (creatures[i]->isAlive())
+            {
+                result.survivors.push_back({ creatures[i]->getName(), creatures[i]->getHp() });
+            }
+        }
+
+        return result;
+    }
+
+private:
+    bool isGame = false;
+    // Все созданные существа, включая погибших, — Game их и удаляет
+    vector<Creature*> creatures;
+
+    void initTeam(Roster& team, vector<CreatureNames> creatureNames, int teamId)
+    {
+        CreatureBuilder builder;
+        map<CreatureNames, int> countByType;
+
+        for (int i = 0; i < (int)creatureNames.size(); i++)
+        {
+            int number = ++countByType[creatureNames[i]];
+            Creature* creature = builder.initCreature(creatureNames[i],
+                builder.getTypeName(creatureNames[i]) + to_string(number), teamId);
+
+            if (creature != NULL)
+            {
+                if (scenario.overrides.count(creatureNames[i])) {
+                    creature->applyOverride(scenario.overrides[creatureNames[i]]);
+                }
+
+                team.add(creature);
+                creatures.push_back(creature);
+            }
+        }
+    }
+
+    void InitializeGame()
+    {
+        initTeam(this->team1, scenario.team1, 1);
+        initTeam(this->team2, scenario.team2, 2);
+        this->area = new Area(scenario.areaSize, this->team1.view(), this->team2.view(), scenario.terrain, scenario.seed);
+
+        initIniciativeCreatures();
+        isGame = true;
+
+        coutInfoAboutTeam(this->team1.view(), "команда зверей");
+        coutInfoAboutTeam(this->team2.view(), "команда людей");
+        coutInfoAboutIniciative();
+    }
+
+    void initIniciativeCreatures()
+    {
+        for (int i = 0; i < (int)this->creatures.size(); i++) {
+            this->listIniciative[this->creatures[i]] = rollDice(20) + this->creatures[i]->getIniciative();
+        }
+
+        //Сортировка по инициативе. Порядок обхода map зависит от адресов существ,
+        //а от него не должен зависеть исход боя с заданным зерном
+        this->turnOrder = this->creatures;
+        stable_sort(this->turnOrder.begin(), this->turnOrder.end(), [this](Creature* a, Creature* b) {
+            return this->listIniciative[a] > this->listIniciative[b];
+        });
+    }
+
+    void coutInfoAboutIniciative()
+    {
+        map <Creature*, int> ::iterator iter = this->listIniciative.begin();
+
+        gameLog() << "Инициатива:" << std::endl;
+
+        for (int i = 0; iter != this->listIniciative.end(); iter++, i++) {
+            gameLog() << "Имя: " << iter->first->getName() << " инициатива: " << iter->second << std::endl;
+        }
+    }
+
+    void game()
+    {
+        while (isGame && round_count < scenario.maxRounds)
+        {
+            //stepCheckStatusCreatures();
+
+            if (this->isGame == false)
+            {
+                return;
+            }
+
+            battle();
+            round_count++;
+        }
+    }
+
+    void battle()
+    {
+        this->area->beginRound();
+
+        for (int i = 0; i < (int)this->turnOrder.size(); i++) {
+            if (this->turnOrder[i]->isAlive() && isGame == true)
+            {
+                if (this->turnOrder[i]->getTeamId() == 1) {
+                    stepDamageEnemy(this->turnOrder[i], team2.view());
+                }
+                else {
+                    stepDamageEnemy(this->turnOrder[i], team1.view());
+                }
+            }
+        }
+    }
+
+    // Погибшие остаются в listIniciative и turnOrder — ход мёртвого пропускается
+    void clearInfoAboutDeadCreature(Creature* creature)
+    {
+        int teamId = creature->getTeamId();
+
+        this->area->removeCreature(creature);
+
+        if (teamId == 1) {
+            this->team1.remove(creature);
+
+            if (team1.empty()) {
+                gameLog() << "Человечество победило";
+                winnerTeamId = 2;
+                coutInfoAboutTeam(team2.view(), "Выжившие");
+                gameOver();
+            }
+        }
+        else {
+            this->team2.remove(creature);
+
+            if (team2.empty()) {
+                gameLog() << "Зверяки победили";
+                winnerTeamId = 1;
+                coutInfoAboutTeam(team1.view(), "Выжившие");
+                gameOver();
+            }
+        }
+    }
+
+    void coutInfoAboutTeam(span<Creature* const> team, string title)
+    {
+        gameLog() << std::endl;
+        gameLog() << title << std::endl;
+
+        for (int i = 0; i < team.size(); i++)
+        {
+            gameLog() << "Имя: " << team[i]->getName() << " " << "Хп: " << team[i]->getHp() << std::endl;
+        }
+    }
+
+    void gameOver()
+    {
+        gameLog() << "\nGame over!" << endl;
+        isGame = false;
+    }
+
+    // enemies смотрит прямо в Roster врагов: после удаления погибшего он уже не нужен
+    void stepDamageEnemy(Creature* creature, span<Creature* const> enemies)
+    {
+        Creature* nearestEnemy;
+
+        nearestEnemy = this->area->findEnemy(creature, enemies);
+        if (nearestEnemy != NULL)
+        {
+            this->area->moveTowards(creature, nearestEnemy, round_count);
+
+            pair<int, int> enemyCoordinate = nearestEnemy->getCoordinate();
+            if (creature->getWeaponForBitEbalo(enemyCoordinate.first, enemyCoordinate.second) == NULL) {
+                return;
+            }
+
+            creature->attack(nearestEnemy);
+
+            // Погибнуть за ход может только тот, кого ударили
+            if (!nearestEnemy->isAlive())
+            {
+                clearInfoAboutDeadCreature(nearestEnemy);
+            }
+        }
+    }
+};
+
+// Планировщик M:N: бои-корутины раздаются фиксированному пулу потоков,
+// каждый поток по кругу продвигает свои бои на один раунд за раз
+class BattleScheduler
+{
+public:
+    BattleScheduler(int workerCount, int maxBattlesPerWorker = 4096)
+    {
+        if (workerCount < 1) {
+            workerCount = 1;
+        }
+
+        this->maxBattlesPerWorker = maxBattlesPerWorker;
+
+        for (int i = 0; i < workerCount; i++)
+        {
+            workers.push_back(thread(&BattleScheduler::workerLoop, this));
+        }
+    }
+
+    BattleScheduler(const BattleScheduler&) = delete;
+    BattleScheduler& operator=(const BattleScheduler&) = delete;
+
+    // Дожидается окончания всех поставленных боёв
+    ~BattleScheduler()
+    {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queueChanged.notify_all();
+
+        for (int i = 0; i < (int)workers.size(); i++)
+        {
+            workers[i].join();
+        }
+    }
+
+    // onFinished, если задан, вызывается на рабочем потоке сразу по окончании боя
+    future<BattleResult> submit(Scenario scenario, function<void(const BattleResult&)> onFinished = NULL)
+    {
+        unique_ptr<Job> job(new Job());
+        job->onFinished = onFinished;
+        job->game.reset(new Game(scenario));
+        // Корутина ленивая: существа создаются уже на рабочем потоке, при первом раунде
+        job->task = job->game->play();
+        job->context.random.seed(scenario.seed);
+        job->context.log = NULL;
+        future<BattleResult> result = job->result.get_future();
+
+        {
+            lock_guard<mutex> lock(queueMutex);
+            pending.push_back(move(job));
+        }
+        queueChanged.notify_one();
+
+        return result;
+    }
+
+private:
+    struct Job
+    {
+        unique_ptr<Game> game;
+        BattleContext context;
+        BattleTask task;
+        promise<BattleResult> result;
+        function<void(const BattleResult&)> onFinished;
+    };
+
+    vector<thread> workers;
+    deque<unique_ptr<Job>> pending;
+    mutex queueMutex;
+    condition_variable queueChanged;
+    bool stopping = false;
+    int maxBattlesPerWorker;
+
+    void workerLoop()
+    {
+        deque<unique_ptr<Job>> active;
+
+        while (true)
+        {
+            {
+                unique_lock<mutex> lock(queueMutex);
+
+                if (active.empty()) {
+                    queueChanged.wait(lock, [this] { return stopping || !pending.empty(); });
+                }
+
+                // Берём свою долю очереди, чтобы не оставить остальных потоков без работы
+                int share = (int)(pending.size() / workers.size()) + 1;
+                while (!pending.empty() && share > 0 && (int)active.size() < maxBattlesPerWorker)
+                {
+                    active.push_back(move(pending.front()));
+                    pending.pop_front();
+                    share--;
+                }
+
+                if (active.empty() && stopping) {
+                    return;
+                }
+            }
+
+            for (int i = (int)active.size(); i > 0; i--)
+            {
+                unique_ptr<Job> job = move(active.front());
+                active.pop_front();
+
+                if (step(*job)) {
+                    active.push_back(move(job));
+                }
+            }
+        }
+    }
+
+    // Один раунд боя. Возвращает false, когда бой окончен и результат отдан
+    bool step(Job& job)
+    {
+        currentBattle = &job.context;
+
+        bool isRunning;
+        try {
+            isRunning = job.task.resume();
+        }
+        catch (...) {
+            currentBattle = NULL;
+            job.result.set_exception(current_exception());
+            return false;
+        }
+
+        currentBattle = NULL;
+
+        if (!isRunning) {
+            BattleResult result = job.game->getResult();
+            if (job.onFinished) {
+                job.onFinished(result);
+            }
+
+            job.result.set_value(result);
+        }
+
+        return isRunning;
+    }
+};
+
+// Четыре int32 одной командой: SSE2 там, где он есть (x64 у g++ и MSVC, x86 с
+// /arch:SSE2), иначе обычный массив с тем же результатом. Маски — 0 или -1
+struct Int32x4
+{
+    static const int WIDTH = 4;
+
+#ifdef LANES_SSE2
+    __m128i v;
+
+    static Int32x4 load(const int32_t* p) { return { _mm_loadu_si128((const __m128i*)p) }; }
+    void store(int32_t* p) const { _mm_storeu_si128((__m128i*)p, v); }
+    static Int32x4 broadcast(int32_t x) { return { _mm_set1_epi32(x) }; }
+
+    Int32x4 operator+(Int32x4 b) const { return { _mm_add_epi32(v, b.v) }; }
+    Int32x4 operator-(Int32x4 b) const { return { _mm_sub_epi32(v, b.v) }; }
+    Int32x4 operator&(Int32x4 b) const { return { _mm_and_si128(v, b.v) }; }
+    Int32x4 operator|(Int32x4 b) const { return { _mm_or_si128(v, b.v) }; }
+    Int32x4 operator^(Int32x4 b) const { return { _mm_xor_si128(v, b.v) }; }
+
+    // ~a & b
+    static Int32x4 andNot(Int32x4 a, Int32x4 b) { return { _mm_andnot_si128(a.v, b.v) }; }
+    // Маска a > b
+    static Int32x4 greater(Int32x4 a, Int32x4 b) { return { _mm_cmpgt_epi32(a.v, b.v) }; }
+
+    template<int N> static Int32x4 shiftLeft(Int32x4 a) { return { _mm_slli_epi32(a.v, N) }; }
+    // Беззнаковый сдвиг, как у uint32_t
+    template<int N> static Int32x4 shiftRight(Int32x4 a) { return { _mm_srli_epi32(a.v, N) }; }
+
+    // Старшие 16 бит произведений 16-битных половин; для чисел меньше 2^16 — (a * b) >> 16
+    static Int32x4 mulHigh16(Int32x4 a, Int32x4 b) { return { _mm_mulhi_epu16(a.v, b.v) }; }
+#else
+    int32_t v[WIDTH];
+
+    static Int32x4 load(const int32_t* p) { Int32x4 r; memcpy(r.v, p, sizeof(r.v)); return r; }
+    void store(int32_t* p) const { memcpy(p, v, sizeof(v)); }
+    static Int32x4 broadcast(int32_t x) { return { { x, x, x, x } }; }
+
+    template<typename Operation>
+    static Int32x4 apply(Int32x4 a, Int32x4 b, Operation operation)
+    {
+        Int32x4 r;
+        for (int i = 0; i < WIDTH; i++) {
+            r.v[i] = operation((uint32_t)a.v[i], (uint32_t)b.v[i]);
+        }
+        return r;
+    }
+
+    Int32x4 operator+(Int32x4 b) const { return apply(*this, b, [](uint32_t x, uint32_t y) { return (int32_t)(x + y); }); }
+    Int32x4 operator-(Int32x4 b) const { return apply(*this, b, [](uint32_t x, uint32_t y) { return (int32_t)(x - y); }); }
+    Int32x4 operator&(Int32x4 b) const { return apply(*this, b, [](uint32_t x, uint32_t y) { return (int32_t)(x & y); }); }
+    Int32x4 operator|(Int32x4 b) const { return apply(*this, b, [](uint32_t x, uint32_t y) { return (int32_t)(x | y); }); }
+    Int32x4 operator^(Int32x4 b) const { return apply(*this, b, [](uint32_t x, uint32_t y) { return (int32_t)(x ^ y); }); }
+
+    static Int32x4 andNot(Int32x4 a, Int32x4 b) { return apply(a, b, [](uint32_t x, uint32_t y) { return (int32_t)(~x & y); }); }
+    static Int32x4 greater(Int32x4 a, Int32x4 b) { return apply(a, b, [](uint32_t x, uint32_t y) { return (int32_t)x > (int32_t)y ? -1 : 0; }); }
+
+    template<int N> static Int32x4 shiftLeft(Int32x4 a) { return apply(a, a, [](uint32_t x, uint32_t) { return (int32_t)(x << N); }); }
+    template<int N> static Int32x4 shiftRight(Int32x4 a) { return apply(a, a, [](uint32_t x, uint32_t) { return (int32_t)(x >> N); }); }
+
+    static Int32x4 mulHigh16(Int32x4 a, Int32x4 b)
+    {
+        return apply(a, b, [](uint32_t x, uint32_t y) {
+            uint32_t low = ((x & 0xffff) * (y & 0xffff)) >> 16;
+            uint32_t high = ((x >> 16) * (y >> 16)) & 0xffff0000u;
+            return (int32_t)(high | low);
+        });
+    }
+#endif
+};
+
+// Пакетное ядро: LANES независимых боёв одного сценария идут в полосах.
+// Каждый ход — по четыре полосы за команду (Int32x4) без ветвлений и без
+// косвенной адресации: характеристики ходящего раскладываются по полосам в
+// начале боя, а цели — первого живого врага — держатся в массивах по полосам
+// и меняются только при смерти, в отдельном скалярном цикле. Броски, проверка
+// брони, урон и смерти считаются масками. Смена цели после смерти скалярная.
+// Поле и перемещения не моделируются: существо бьёт первым оружием первого
+// живого врага в порядке состава. Броня проверяется как в Creature::attack —
+// бросок d20 делает защищающийся со своим бонусом атаки
+class LaneBattleKernel
+{
+public:
+    static const int LANES = 16;
+    static_assert(LANES % Int32x4::WIDTH == 0, "полосы идут блоками по Int32x4::WIDTH");
+
+    LaneBattleKernel(Scenario scenario)
+    {
+        CreatureBuilder builder;
+        this->scenario = scenario;
+
+        for (int teamId = 1; teamId <= 2; teamId++)
+        {
+            vector<CreatureNames>& team = teamId == 1 ? this->scenario.team1 : this->scenario.team2;
+            map<CreatureNames, int> countByType;
+
+            for (int i = 0; i < (int)team.size(); i++)
+            {
+                int number = ++countByType[team[i]];
+                CreatureProfile profile = builder.getProfile(team[i]);
+                if (this->scenario.overrides.count(team[i])) {
+                    this->scenario.overrides[team[i]].applyTo(profile);
+                }
+
+                slotNames.push_back(builder.getTypeName(team[i]) + to_string(number));
+                slotProfiles.push_back(profile);
+                slotTeams.push_back(teamId);
+                slotArmor.push_back(profile.armor);
+                slotBonusAtack.push_back(profile.bonusAtack);
+                slotNumberDice.push_back(profile.weaponNumberDiceRoll);
+                slotMaxDice.push_back(profile.weaponMaxDiceNumber);
+            }
+        }
+
+        slotCount = (int)slotProfiles.size();
+        team1Size = (int)this->scenario.team1.size();
+        maxWeaponDice = 0;
+        for (int s = 0; s < slotCount; s++)
+        {
+            maxWeaponDice = max(maxWeaponDice, slotNumberDice[s]);
+        }
+
+        hp.resize(slotCount * LANES);
+        actorSlot.resize(slotCount * LANES);
+        actorIsTeam1.resize(slotCount * LANES);
+        actorBonusAtack.resize(slotCount * LANES);
+        actorNumberDice.resize(slotCount * LANES);
+        actorMaxDice.resize(slotCount * LANES);
+    }
+
+    // Проводит battleCount боёв, зерно i-го боя — scenario.seed + i
+    vector<BattleResult> run(int battleCount)
+    {
+        vector<BattleResult> results(battleCount);
+        int nextBattle = 0;
+        int running = 0;
+
+        for (int l = 0; l < LANES; l++)
+        {
+            laneBattle[l] = -1;
+            finished[l] = 1;
+            if (nextBattle < battleCount) {
+                startBattle(l, nextBattle++);
+                running++;
+            }
+        }
+
+        while (running > 0)
+        {
+            playRound();
+
+            // Закончившиеся полосы сразу получают следующий бой
+            for (int l = 0; l < LANES; l++)
+            {
+                if (laneBattle[l] < 0 || (!finished[l] && rounds[l] < scenario.maxRounds)) {
+                    continue;
+                }
+
+                results[laneBattle[l]] = getResult(l);
+                laneBattle[l] = -1;
+                finished[l] = 1;
+                running--;
+
+                if (nextBattle < battleCount) {
+                    startBattle(l, nextBattle++);
+                    running++;
+                }
+            }
+        }
+
+        return results;
+    }
+
+private:
+    Scenario scenario;
+    vector<string> slotNames;
+    vector<CreatureProfile> slotProfiles;
+    vector<int32_t> slotTeams, slotArmor, slotBonusAtack, slotNumberDice, slotMaxDice;
+    int slotCount;
+    int team1Size;
+    int maxWeaponDice;
+
+    // hp[s * LANES + l] — здоровье существа s в бою полосы l; у первого живого
+    // в команде оно устаревает, настоящее лежит в frontHp
+    vector<int32_t> hp;
+    // Тот, кто ходит k-м в бою полосы l, и его характеристики: [k * LANES + l]
+    vector<int32_t> actorSlot, actorIsTeam1, actorBonusAtack, actorNumberDice, actorMaxDice;
+
+    // Бьют всегда первого живого врага, поэтому живые в команде — это хвост
+    // её слотов, и вместо счётчика живых хватит номера первого живого.
+    // Его здоровье, броня и бонус атаки (им он бросает на броню) — рядом
+    int32_t firstAlive1[LANES], frontHp1[LANES], frontArmor1[LANES], frontBonus1[LANES];
+    int32_t firstAlive2[LANES], frontHp2[LANES], frontArmor2[LANES], frontBonus2[LANES];
+
+    uint32_t random[LANES];
+    int32_t finished[LANES];
+    int32_t winner[LANES];
+    int32_t rounds[LANES];
+    int laneBattle[LANES];
+    vector<pair<int, int>> iniciative;
+
+    static uint32_t nextRandom(uint32_t& state)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    // Бросок d`maxDiceNumber` умножением вместо деления — так его можно считать
+    // сразу в нескольких полосах
+    static int32_t rollLane(uint32_t& state, int32_t maxDiceNumber)
+    {
+        return 1 + (int32_t)(((nextRandom(state) >> 16) * (uint32_t)maxDiceNumber) >> 16);
+    }
+
+    // То же в четырёх полосах
+    static Int32x4 rollLanes(Int32x4& state, Int32x4 maxDiceNumber)
+    {
+        state = state ^ Int32x4::shiftLeft<13>(state);
+        state = state ^ Int32x4::shiftRight<17>(state);
+        state = state ^ Int32x4::shiftLeft<5>(state);
+        return Int32x4::broadcast(1) + Int32x4::mulHigh16(Int32x4::shiftRight<16>(state), maxDiceNumber);
+    }
+
+    void startBattle(int l, int battle)
+    {
+        // splitmix32, чтобы соседние зёрна давали несвязанные потоки
+        uint32_t seed = scenario.seed + (uint32_t)battle;
+        seed = (seed ^ (seed >> 16)) * 0x45d9f3bu;
+        seed = (seed ^ (seed >> 16)) * 0x45d9f3bu;
+        seed ^= seed >> 16;
+        random[l] = seed == 0 ? 0x9e3779b9u : seed;
+
+        laneBattle[l] = battle;
+        finished[l] = 0;
+        winner[l] = 0;
+        rounds[l] = 0;
+
+        iniciative.clear();
+        for (int s = 0; s < slotCount; s++)
+        {
+            CreatureProfile& profile = slotProfiles[s];
+            int health = profile.addHp;
+            for (int i = 0; i < profile.numberDiceRoll; i++) {
+                health += rollLane(random[l], profile.maxDiceNumberForHp);
+            }
+
+            hp[s * LANES + l] = health;
+            iniciative.push_back({ rollLane(random[l], 20) + profile.bonusIniciative, s });
+        }
+
+        // Как в Game: по убыванию инициативы, при равенстве — в порядке создания
+        stable_sort(iniciative.begin(), iniciative.end(), [](pair<int, int> a, pair<int, int> b) {
+            return a.first > b.first;
+        });
+
+        for (int k = 0; k < slotCount; k++)
+        {
+            int s = iniciative[k].second;
+            actorSlot[k * LANES + l] = s;
+            actorIsTeam1[k * LANES + l] = s < team1Size;
+            actorBonusAtack[k * LANES + l] = slotBonusAtack[s];
+            actorNumberDice[k * LANES + l] = slotNumberDice[s];
+            actorMaxDice[k * LANES + l] = slotMaxDice[s];
+        }
+
+        firstAlive1[l] = 0;
+        firstAlive2[l] = team1Size;
+        loadFront(l, 1);
+        loadFront(l, 2);
+    }
+
+    // Загружает первого живого команды teamId в полосе l, если в ней кто-то остался
+    void loadFront(int l, int teamId)
+    {
+        int s = teamId == 1 ? firstAlive1[l] : firstAlive2[l];
+
+        if (teamId == 1 && s < team1Size) {
+            frontHp1[l] = hp[s * LANES + l];
+            frontArmor1[l] = slotArmor[s];
+            frontBonus1[l] = slotBonusAtack[s];
+        }
+        else if (teamId == 2 && s < slotCount) {
+            frontHp2[l] = hp[s * LANES + l];
+            frontArmor2[l] = slotArmor[s];
+            frontBonus2[l] = slotBonusAtack[s];
+        }
+    }
+
+    // Выбор по маске без ветвления: mask — 0 или -1
+    static Int32x4 select(Int32x4 mask, Int32x4 ifOne, Int32x4 ifZero)
+    {
+        return ifZero ^ ((ifOne ^ ifZero) & mask);
+    }
+
+    void playRound()
+    {
+        int32_t playing[LANES];
+        Int32x4 zero = Int32x4::broadcast(0);
+        Int32x4 one = Int32x4::broadcast(1);
+
+        for (int l = 0; l < LANES; l += Int32x4::WIDTH)
+        {
+            (Int32x4::load(finished + l) ^ one).store(playing + l);
+        }
+
+        for (int k = 0; k < slotCount; k++)
+        {
+            const int32_t* slot = this->actorSlot.data() + k * LANES;
+            const int32_t* isTeam1 = this->actorIsTeam1.data() + k * LANES;
+            const int32_t* bonusAtack = this->actorBonusAtack.data() + k * LANES;
+            const int32_t* numberDice = this->actorNumberDice.data() + k * LANES;
+            const int32_t* maxDice = this->actorMaxDice.data() + k * LANES;
+            int32_t isKilled[LANES];
+
+            // В каждой полосе броски идут в том же порядке, что и раньше: d20, затем кости урона
+            for (int l = 0; l < LANES; l += Int32x4::WIDTH)
+            {
+                Int32x4 state = Int32x4::load((const int32_t*)random + l);
+                Int32x4 team1 = zero - Int32x4::load(isTeam1 + l);
+                Int32x4 hp1 = Int32x4::load(frontHp1 + l);
+                Int32x4 hp2 = Int32x4::load(frontHp2 + l);
+
+                // Живы те, кто не раньше первого живого своей команды
+                Int32x4 ownFront = select(team1, Int32x4::load(firstAlive1 + l), Int32x4::load(firstAlive2 + l));
+                Int32x4 isInactive = (zero - Int32x4::load(finished + l)) | Int32x4::greater(ownFront, Int32x4::load(slot + l));
+
+                Int32x4 d20 = rollLanes(state, Int32x4::broadcast(20))
+                    + select(team1, Int32x4::load(frontBonus2 + l), Int32x4::load(frontBonus1 + l));
+                Int32x4 armor = select(team1, Int32x4::load(frontArmor2 + l), Int32x4::load(frontArmor1 + l));
+                Int32x4 isHit = Int32x4::andNot(isInactive | Int32x4::greater(armor, d20), Int32x4::broadcast(-1));
+
+                // Кость бросается и тогда, когда у оружия их меньше, — так поток бросков полосы не зависит от оружия
+                Int32x4 damage = Int32x4::load(bonusAtack + l);
+                Int32x4 diceCount = Int32x4::load(numberDice + l);
+                Int32x4 diceMax = Int32x4::load(maxDice + l);
+                for (int d = 0; d < maxWeaponDice; d++)
+                {
+                    damage = damage + (rollLanes(state, diceMax) & Int32x4::greater(diceCount, Int32x4::broadcast(d)));
+                }
+
+                Int32x4 after = select(team1, hp2, hp1) - (damage & isHit);
+                select(team1, after, hp2).store(frontHp2 + l);
+                select(team1, hp1, after).store(frontHp1 + l);
+                Int32x4::andNot(Int32x4::greater(after, zero), isHit).store(isKilled + l);
+                state.store((int32_t*)random + l);
+            }
+
+            // Смерть редка: цель меняется скалярно, только в полосах, где кто-то погиб
+            for (int l = 0; l < LANES; l++)
+            {
+                if (!isKilled[l]) {
+                    continue;
+                }
+
+                if (isTeam1[l]) {
+                    hp[firstAlive2[l] * LANES + l] = frontHp2[l];
+                    firstAlive2[l]++;
+                    loadFront(l, 2);
+                }
+                else {
+                    hp[firstAlive1[l] * LANES + l] = frontHp1[l];
+                    firstAlive1[l]++;
+                    loadFront(l, 1);
+                }
+
+                if (firstAlive2[l] == slotCount || firstAlive1[l] == team1Size) {
+                    winner[l] = firstAlive2[l] == slotCount ? 1 : 2;
+                    finished[l] = 1;
+                }
+            }
+        }
+
+        for (int l = 0; l < LANES; l += Int32x4::WIDTH)
+        {
+            (Int32x4::load(rounds + l) + Int32x4::load(playing + l)).store(rounds + l);
+        }
+    }
+
+    BattleResult getResult(int l)
+    {
+        BattleResult result;
+        result.seed = scenario.seed + (unsigned int)laneBattle[l];
+        result.winnerTeamId = winner[l];
+        result.rounds = rounds[l];
+
+        if (firstAlive1[l] < team1Size) {
+            hp[firstAlive1[l] * LANES + l] = frontHp1[l];
+        }
+        if (firstAlive2[l] < slotCount) {
+            hp[firstAlive2[l] * LANES + l] = frontHp2[l];
+        }
+
+        for (int s = 0; s < slotCount; s++)
+        {
+            if (hp[s * LANES + l] > 0)
+            {
+                result.survivors.push_back({ slotNames[s], hp[s * LANES + l] });
+            }
+        }
+
+        return result;
+    }
+};
+
+struct ExactOutcome
+{
+    double team1;
+    double team2;
+    // Посчитанных состояний: передние бойцы команд, их здоровье и порядок ходов живых
+    long long states;
+};
+
+// Точные вероятности исхода небольшого боя без розыгрыша: динамика по
+// состояниям цепи Маркова той же модели, что в LaneBattleKernel.
+// Попадание — доля граней d20, при которых бросок защищающегося с его
+// бонусом атаки не меньше его брони (как в Creature::attack), урон — точное
+// распределение суммы костей оружия (как в Weapon::getDamage) плюс бонус
+// атаки. Порядок ходов разыгрывается по инициативе один раз за бой, поэтому
+// ответ — среднее по порядкам. Лимит раундов не учитывается.
+// Бьют всегда первого живого врага, поэтому ранен только передний боец команды,
+// а у стоящих за ним здоровье начальное — его распределение подставляется, лишь
+// когда боец выходит вперёд. Состояние — здоровье двух передних и круг ходов
+// живых: порядки, различающиеся сдвигом или местами погибших, делят одну таблицу.
+// Позиций здесь нет, как и в LaneBattleKernel, поэтому ответ проверяет пакетное
+// ядро, а не бой Game на поле: там существа сперва идут к цели, выбирают
+// ближайшего врага, и исход бывает заметно другим
+class ExactOutcomeSolver
+{
+public:
+    static const int MAX_CREATURES = 7;
+    static const long long MAX_STATES = 1 << 24;
+
+    bool solve(Scenario scenario, ExactOutcome& outcome, string& error)
+    {
+        CreatureBuilder builder;
+        profiles.clear();
+        teams.clear();
+        tables.clear();
+
+        for (int teamId = 1; teamId <= 2; teamId++)
+        {
+            vector<CreatureNames>& team = teamId == 1 ? scenario.team1 : scenario.team2;
+            for (int i = 0; i < (int)team.size(); i++)
+            {
+                CreatureProfile profile = builder.getProfile(team[i]);
+                if (scenario.overrides.count(team[i])) {
+                    scenario.overrides[team[i]].applyTo(profile);
+                }
+
+                profiles.push_back(profile);
+                teams.push_back(teamId);
+            }
+        }
+
+        count = (int)profiles.size();
+        team1Size = (int)scenario.team1.size();
+        if (count > MAX_CREATURES) {
+            error = "точный расчёт только для боёв до " + to_string(MAX_CREATURES) + " существ";
+            return false;
+        }
+
+        initialHp.clear();
+        damage.clear();
+        hitChance.clear();
+        for (int i = 0; i < count; i++)
+        {
+            initialHp.push_back(diceSum(profiles[i].numberDiceRoll, profiles[i].maxDiceNumberForHp, profiles[i].addHp));
+            damage.push_back(diceSum(profiles[i].weaponNumberDiceRoll, profiles[i].weaponMaxDiceNumber, profiles[i].bonusAtack));
+
+            int facesToHit = 21 - max(profiles[i].armor - profiles[i].bonusAtack, 1);
+            hitChance.push_back(min(max(facesToHit, 0), 20) / 20.0);
+        }
+
+        // Худший случай: все круги ходов для каждой пары передних бойцов
+        long long slots = 0;
+        for (int front1 = 0; front1 < team1Size; front1++)
+        {
+            for (int front2 = team1Size; front2 < count; front2++)
+            {
+                int alive = team1Size - front1 + count - front2;
+                long long cycles = 1;
+                for (int k = 2; k < alive; k++) {
+                    cycles *= k;
+                }
+
+                slots += cycles * alive * (long long)initialHp[front1].size() * (long long)initialHp[front2].size();
+            }
+        }
+
+        if (slots > MAX_STATES) {
+            error = "слишком много состояний для точного расчёта";
+            return false;
+        }
+
+        outcome.team1 = 0;
+        outcome.team2 = 0;
+        outcome.states = 0;
+
+        if (team1Size == 0 || team1Size == count) {
+            return true;
+        }
+
+        vector<int> order(count);
+        for (int i = 0; i < count; i++) {
+            order[i] = i;
+        }
+
+        do {
+            double orderChance = getOrderChance(order);
+            if (orderChance == 0) {
+                continue;
+            }
+
+            Table& table = getTable(order);
+            int position = find(table.cycle.begin(), table.cycle.end(), order[0]) - table.cycle.begin();
+            double value1, value2;
+
+            getStartValue(table, position, value1, value2);
+            outcome.team1 += orderChance * value1;
+            outcome.team2 += orderChance * value2;
+        } while (next_permutation(order.begin(), order.end()));
+
+        for (auto& [key, table] : tables)
+        {
+            for (int s = 0; s < (int)table.solved.size(); s++) {
+                outcome.states += table.solved[s];
+            }
+        }
+
+        return true;
+    }
+
+private:
+    // Состояния с одним и тем же кругом ходов живых. Круг повёрнут так, что первым
+    // идёт меньший номер существа; передние бойцы — первые живые каждой команды
+    struct Table
+    {
+        vector<int> cycle;
+        int front1;
+        int front2;
+        int hpCount2;
+        // win1[(hp1 * hpCount2 + hp2) * cycle.size() + p] — вероятность победы
+        // команды 1, если ходит cycle[p]
+        vector<double> win1;
+        vector<double> win2;
+        vector<char> solved;
+        // Те же вероятности, усреднённые по здоровью только что вышедшего вперёд бойца
+        // команды k + 1; индекс — здоровье переднего бойца другой команды * cycle.size() + p
+        vector<double> promotedWin1[2];
+        vector<double> promotedWin2[2];
+        vector<char> isPromoted[2];
+    };
+
+    int count;
+    int team1Size;
+    vector<CreatureProfile> profiles;
+    vector<int> teams;
+    // initialHp[i][h] и damage[i][d] — вероятности здоровья h и урона d
+    vector<vector<double>> initialHp;
+    vector<vector<double>> damage;
+    vector<double> hitChance;
+    // По кругу ходов; узлы не переезжают, ссылки на таблицы остаются верными
+    unordered_map<uint32_t, Table> tables;
+
+    // Распределение addValue + суммы number бросков d`maxDiceNumber`
+    static vector<double> diceSum(int number, int maxDiceNumber, int addValue)
+    {
+        vector<double> sum(addValue + 1, 0);
+        sum[addValue] = 1;
+
+        for (int n = 0; n < number; n++)
+        {
+            vector<double> next(sum.size() + maxDiceNumber, 0);
+            for (int s = 0; s < (int)sum.size(); s++)
+            {
+                for (int face = 1; face <= maxDiceNumber; face++)
+                {
+                    next[s + face] += sum[s] / maxDiceNumber;
+                }
+            }
+
+            sum = next;
+        }
+
+        return sum;
+    }
+
+    // Вероятность, что сортировка по d20 + инициатива (при равенстве — по
+    // порядку создания, как stable_sort в Game) даст именно этот порядок
+    double getOrderChance(vector<int>& order)
+    {
+        int maxIniciative = 0;
+        for (int i = 0; i < count; i++) {
+            maxIniciative = max(maxIniciative, profiles[i].bonusIniciative);
+        }
+
+        int values = maxIniciative + 21;
+        vector<double> chance(values, 0);
+        for (int d = 1; d <= 20; d++) {
+            chance[d + profiles[order[0]].bonusIniciative] = 1 / 20.0;
+        }
+
+        for (int k = 1; k < count; k++)
+        {
+            vector<double> next(values, 0);
+            bool isTieAllowed = order[k - 1] < order[k];
+            double atLeast = 0;
+
+            // atLeast — вероятность, что предыдущее значение не меньше v (или больше v, если ничья запрещена)
+            for (int v = values - 1; v >= 0; v--)
+            {
+                if (isTieAllowed) { atLeast += chance[v]; }
+
+                if (v >= 1 + profiles[order[k]].bonusIniciative && v <= 20 + profiles[order[k]].bonusIniciative) {
+                    next[v] = atLeast / 20;
+                }
+
+                if (!isTieAllowed) { atLeast += chance[v]; }
+            }
+
+            chance = next;
+        }
+
+        double total = 0;
+        for (int v = 0; v < values; v++) {
+            total += chance[v];
+        }
+
+        return total;
+    }
+
+    // Таблица круга ходов живых существ в порядке cycle (с любого места круга)
+    Table& getTable(const vector<int>& cycle)
+    {
+        int first = min_element(cycle.begin(), cycle.end()) - cycle.begin();
+        uint32_t key = (uint32_t)cycle.size() << 24;
+        for (int p = 0; p < (int)cycle.size(); p++) {
+            key |= (uint32_t)cycle[(first + p) % cycle.size()] << (3 * p);
+        }
+
+        auto [found, isNew] = tables.try_emplace(key);
+        Table& table = found->second;
+        if (!isNew) {
+            return table;
+        }
+
+        table.cycle.assign(cycle.begin() + first, cycle.end());
+        table.cycle.insert(table.cycle.end(), cycle.begin(), cycle.begin() + first);
+        table.front1 = count;
+        table.front2 = count;
+        for (int p = 0; p < (int)cycle.size(); p++) {
+            int& front = teams[cycle[p]] == 1 ? table.front1 : table.front2;
+            front = min(front, cycle[p]);
+        }
+
+        table.hpCount2 = (int)initialHp[table.front2].size();
+        size_t stateCount = initialHp[table.front1].size() * table.hpCount2;
+        table.win1.assign(stateCount * cycle.size(), 0);
+        table.win2.assign(stateCount * cycle.size(), 0);
+        table.solved.assign(stateCount, 0);
+
+        for (int k = 0; k < 2; k++)
+        {
+            size_t otherHpCount = initialHp[k == 0 ? table.front2 : table.front1].size();
+            table.promotedWin1[k].assign(otherHpCount * cycle.size(), 0);
+            table.promotedWin2[k].assign(otherHpCount * cycle.size(), 0);
+            table.isPromoted[k].assign(otherHpCount, 0);
+        }
+
+        return table;
+    }
+
+    // Заполняет promotedWin[teamId - 1] для здоровья otherHp переднего бойца другой команды
+    void promote(Table& table, int teamId, int otherHp)
+    {
+        int k = teamId - 1;
+        if (table.isPromoted[k][otherHp]) {
+            return;
+        }
+
+        int size = (int)table.cycle.size();
+        vector<double>& hpChance = initialHp[teamId == 1 ? table.front1 : table.front2];
+        double* value1 = &table.promotedWin1[k][(size_t)otherHp * size];
+        double* value2 = &table.promotedWin2[k][(size_t)otherHp * size];
+
+        for (int hp = 1; hp < (int)hpChance.size(); hp++)
+        {
+            if (hpChance[hp] == 0) {
+                continue;
+            }
+
+            int hp1 = teamId == 1 ? hp : otherHp;
+            int hp2 = teamId == 1 ? otherHp : hp;
+            size_t state = (size_t)hp1 * table.hpCount2 + hp2;
+            solveState(table, hp1, hp2);
+
+            for (int p = 0; p < size; p++)
+            {
+                value1[p] += hpChance[hp] * table.win1[state * size + p];
+                value2[p] += hpChance[hp] * table.win2[state * size + p];
+            }
+        }
+
+        table.isPromoted[k][otherHp] = 1;
+    }
+
+    // Начало боя: здоровье обоих передних бойцов берётся из начального распределения
+    void getStartValue(Table& table, int position, double& value1, double& value2)
+    {
+        int size = (int)table.cycle.size();
+        vector<double>& hpChance = initialHp[table.front1];
+        value1 = 0;
+        value2 = 0;
+
+        for (int hp1 = 1; hp1 < (int)hpChance.size(); hp1++)
+        {
+            if (hpChance[hp1] == 0) {
+                continue;
+            }
+
+            promote(table, 2, hp1);
+            value1 += hpChance[hp1] * table.promotedWin1[1][(size_t)hp1 * size + position];
+            value2 += hpChance[hp1] * table.promotedWin2[1][(size_t)hp1 * size + position];
+        }
+    }
+
+    // Считает вероятности для всех мест круга в состоянии (hp1, hp2). Любое попадание
+    // уменьшает здоровье или убирает бойца, поэтому зависимость от других состояний
+    // идёт только вниз, а внутри состояния промахи замыкают ходы в кольцо:
+    // V[p] = miss[p] * V[p + 1] + hit[p], V[size] = V[0]
+    void solveState(Table& table, int hp1, int hp2)
+    {
+        size_t state = (size_t)hp1 * table.hpCount2 + hp2;
+        if (table.solved[state]) {
+            return;
+        }
+
+        int size = (int)table.cycle.size();
+        double miss[MAX_CREATURES], hit1[MAX_CREATURES] = {}, hit2[MAX_CREATURES] = {};
+
+        for (int p = 0; p < size; p++)
+        {
+            int a = table.cycle[p];
+            bool isTeam1 = teams[a] == 1;
+            int target = isTeam1 ? table.front2 : table.front1;
+            int targetHp = isTeam1 ? hp2 : hp1;
+            int next = p + 1 == size ? 0 : p + 1;
+
+            miss[p] = 1 - hitChance[target];
+
+            double killChance = 0;
+            for (int d = 1; d < (int)damage[a].size(); d++)
+            {
+                double chance = hitChance[target] * damage[a][d];
+                if (chance == 0) {
+                    continue;
+                }
+
+                if (d >= targetHp) {
+                    killChance += chance;
+                    continue;
+                }
+
+                int nextHp1 = isTeam1 ? hp1 : hp1 - d;
+                int nextHp2 = isTeam1 ? hp2 - d : hp2;
+                size_t nextState = (size_t)nextHp1 * table.hpCount2 + nextHp2;
+
+                solveState(table, nextHp1, nextHp2);
+                hit1[p] += chance * table.win1[nextState * size + next];
+                hit2[p] += chance * table.win2[nextState * size + next];
+            }
+
+            if (killChance == 0) {
+                continue;
+            }
+
+            // Убит последний в команде — победа; иначе вперёд выходит следующий
+            bool isLast = target + 1 == (isTeam1 ? count : team1Size);
+            if (isLast) {
+                (isTeam1 ? hit1[p] : hit2[p]) += killChance;
+                continue;
+            }
+
+            vector<int> cycle;
+            int nextActor = -1;
+            for (int k = 1; k <= size; k++)
+            {
+                int creature = table.cycle[(p + k) % size];
+                if (creature != target) {
+                    cycle.push_back(creature);
+                    nextActor = nextActor < 0 ? creature : nextActor;
+                }
+            }
+
+            Table& nextTable = getTable(cycle);
+            int position = find(nextTable.cycle.begin(), nextTable.cycle.end(), nextActor) - nextTable.cycle.begin();
+            int attackerHp = isTeam1 ? hp1 : hp2;
+            size_t index = (size_t)attackerHp * nextTable.cycle.size() + position;
+
+            promote(nextTable, teams[target], attackerHp);
+            hit1[p] += killChance * nextTable.promotedWin1[teams[target] - 1][index];
+            hit2[p] += killChance * nextTable.promotedWin2[teams[target] - 1][index];
+        }
+
+        // V[0] = (sum_p miss[0..p-1] * hit[p]) / (1 - miss[0..size-1])
+        double missAll = 1, sum1 = 0, sum2 = 0;
+        for (int p = 0; p < size; p++)
+        {
+            sum1 += missAll * hit1[p];
+            sum2 += missAll * hit2[p];
+            missAll *= miss[p];
+        }
+
+        // Никто никого не может задеть — бой не закончится, обе победы невозможны
+        double* value1 = &table.win1[state * size];
+        double* value2 = &table.win2[state * size];
+        value1[0] = missAll < 1 ? sum1 / (1 - missAll) : 0;
+        value2[0] = missAll < 1 ? sum2 / (1 - missAll) : 0;
+
+        for (int p = size - 1; p > 0; p--)
+        {
+            int next = p + 1 == size ? 0 : p + 1;
+            value1[p] = miss[p] * value1[next] + hit1[p];
+            value2[p] = miss[p] * value2[next] + hit2[p];
+        }
+
+        table.solved[state] = 1;
+    }
+};
+
+// Последовательная оценка вероятности победы команды 1 (ничья — не победа).
+// Либо доверительный интервал Уилсона сужается до заданной полуширины,
+// либо тест Вальда (SPRT) выбирает между p <= p0 и p >= p1
+class WinRateTest
+{
+public:
+    // Остановиться, когда полуширина интервала не больше halfWidth
+    static WinRateTest confidenceInterval(double halfWidth, int maxBattles)
+    {
+        WinRateTest test;
+        test.halfWidth = halfWidth;
+        test.maxBattles = maxBattles;
+        return test;
+    }
+
+    // Ошибка первого рода alpha, второго — beta
+    static WinRateTest sprt(double p0, double p1, double alpha, double beta, int maxBattles)
+    {
+        WinRateTest test;
+        test.isSprt = true;
+        test.winStep = log(p1 / p0);
+        test.lossStep = log((1 - p1) / (1 - p0));
+        test.upperBound = log((1 - beta) / alpha);
+        test.lowerBound = log(beta / (1 - alpha));
+        test.maxBattles = maxBattles;
+        return test;
+    }
+
+    void add(const BattleResult& result)
+    {
+        battles++;
+        if (result.winnerTeamId == 1) {
+            wins++;
+            logLikelihood += winStep;
+        }
+        else {
+            logLikelihood += lossStep;
+        }
+    }
+
+    bool isDone()
+    {
+        if (battles >= maxBattles) {
+            return true;
+        }
+
+        if (battles < minBattles) {
+            return false;
+        }
+
+        if (isSprt) {
+            return logLikelihood >= upperBound || logLikelihood <= lowerBound;
+        }
+
+        return getHalfWidth() <= halfWidth;
+    }
+
+    int getMaxBattles() { return maxBattles; }
+    int getBattles() { return battles; }
+    int getWins() { return wins; }
+
+    double getWinRate()
+    {
+        return battles == 0 ? 0 : (double)wins / battles;
+    }
+
+    // Центр интервала Уилсона
+    double getCenter()
+    {
+        double n = battles, z2 = z * z;
+        return (wins + z2 / 2) / (n + z2);
+    }
+
+    double getHalfWidth()
+    {
+        if (battles == 0) {
+            return 1;
+        }
+
+        double n = battles, z2 = z * z, p = getWinRate();
+        return z * sqrt(p * (1 - p) / n + z2 / (4 * n * n)) / (1 + z2 / n);
+    }
+
+    string getVerdict()
+    {
+        if (!isSprt) {
+            return getHalfWidth() <= halfWidth ? "precision" : "limit";
+        }
+
+        if (logLikelihood >= upperBound) { return "H1"; }
+        if (logLikelihood <= lowerBound) { return "H0"; }
+        return "limit";
+    }
+
+private:
+    // 95% доверия
+    static constexpr double z = 1.96;
+    static const int minBattles = 30;
+
+    int maxBattles = 0;
+    int battles = 0;
+    int wins = 0;
+
+    double halfWidth = 0;
+
+    bool isSprt = false;
+    double winStep = 0, lossStep = 0;
+    double upperBound = 0, lowerBound = 0;
+    double logLikelihood = 0;
+};
+
+// Гоняет бои сценария на планировщике, пока WinRateTest не остановится.
+// В полёте держится окно из window боёв; результаты приходят с рабочих
+// потоков, но в тест идут строго по номеру боя: короткие бои заканчиваются
+// раньше, и учёт в порядке прихода сместил бы оценку
+class AdaptiveRunner
+{
+public:
+    AdaptiveRunner(BattleScheduler& scheduler, int window) : scheduler(scheduler)
+    {
+        this->window = window < 1 ? 1 : window;
+    }
+
+    // Зерно i-го боя — scenario.seed + i, как и у LaneBattleKernel
+    WinRateTest run(Scenario scenario, WinRateTest test)
+    {
+        map<int, BattleResult> arrived;
+        int submitted = 0;
+        int finished = 0;
+        int consumed = 0;
+        mutex resultsMutex;
+        condition_variable resultArrived;
+
+        auto submitNext = [&]() {
+            Scenario battle = scenario;
+            battle.seed = scenario.seed + submitted;
+            int number = submitted++;
+
+            scheduler.submit(battle, [&, number](const BattleResult& result) {
+                lock_guard<mutex> lock(resultsMutex);
+                arrived[number] = result;
+                finished++;
+                resultArrived.notify_one();
+            });
+        };
+
+        unique_lock<mutex> lock(resultsMutex);
+
+        while (!test.isDone())
+        {
+            while (submitted < consumed + window && submitted < test.getMaxBattles()) {
+                submitNext();
+            }
+
+            resultArrived.wait(lock, [&] { return arrived.count(consumed) > 0; });
+
+            while (arrived.count(consumed) && !test.isDone())
+            {
+                test.add(arrived[consumed]);
+                arrived.erase(consumed);
+                consumed++;
+            }
+        }
+
+        // Оставшиеся в полёте бои ссылаются на локальные переменные — дожидаемся их
+        resultArrived.wait(lock, [&] { return finished == submitted; });
+
+        return test;
+    }
+
+private:
+    BattleScheduler& scheduler;
+    int window;
+};
+
+// Столбцовое хранилище результатов серии: каталог, в нём по файлу на столбец.
+// Строка — один бой: scenario, seed, winner, rounds и survivors — число выживших.
+// Выжившие подряд лежат в survivor_name (номер строки словаря names.txt) и survivor_hp.
+// Файл checkpoint говорит, сколько строк записано целиком; всё, что в столбцах дальше,
+// при открытии отрезается, так что прерванная серия продолжается ровно с этого места
+class ResultSink
+{
+public:
+    ResultSink()
+    {
+        const char* names[] = { "scenario", "seed", "winner", "rounds", "survivors", "survivor_name", "survivor_hp" };
+        int widths[] = { 4, 4, 1, 4, 2, 4, 2 };
+
+        for (int i = 0; i < 7; i++) {
+            columns.emplace_back(names[i], widths[i]);
+        }
+    }
+
+    ResultSink(const ResultSink&) = delete;
+    ResultSink& operator=(const ResultSink&) = delete;
+
+    // sweepHash отличает серии друг от друга: продолжить чужую серию нельзя
+    bool open(string directory, uint64_t sweepHash, string& error)
+    {
+        this->directory = directory;
+        this->sweepHash = sweepHash;
+
+        std::error_code code;
+        filesystem::create_directories(directory, code);
+        if (code) {
+            error = "не удалось создать каталог " + directory;
+            return false;
+        }
+
+        uint64_t storedHash = sweepHash;
+        uint64_t namesBytes = 0;
+        if (!readCheckpoint(directory, storedHash, rowCount, survivorCount, namesBytes)) {
+            rowCount = survivorCount = namesBytes = 0;
+        }
+        else if (storedHash != sweepHash) {
+            error = "в каталоге " + directory + " лежит другая серия";
+            return false;
+        }
+
+        for (int i = 0; i < (int)columns.size(); i++)
+        {
+            uint64_t count = i < survivorColumns ? rowCount : survivorCount;
+            if (!truncate(columnPath(columns[i].fileName), count * columns[i].width, error)) {
+                return false;
+            }
+
+            columns[i].file.open(columnPath(columns[i].fileName), ios::binary | ios::app);
+        }
+
+        if (!truncate(directory + "/names.txt", namesBytes, error)) {
+            return false;
+        }
+
+        ifstream names(directory + "/names.txt");
+        string name;
+        while (getline(names, name)) {
+            nameIds[name] = (uint32_t)nameIds.size();
+        }
+        namesFile.open(directory + "/names.txt", ios::binary | ios::app);
+        this->namesBytes = namesBytes;
+
+        return true;
+    }
+
+    uint64_t getRowCount()
+    {
+        return rowCount;
+    }
+
+    void append(uint32_t scenarioIndex, const BattleResult& result)
+    {
+        put(columns[0], scenarioIndex);
+        put(columns[1], (uint32_t)result.seed);
+        put(columns[2], (uint8_t)result.winnerTeamId);
+        put(columns[3], (uint32_t)result.rounds);
+        put(columns[4], (uint16_t)result.survivors.size());
+
+        for (int i = 0; i < (int)result.survivors.size(); i++)
+        {
+            put(columns[5], findNameId(result.survivors[i].first));
+            put(columns[6], (int16_t)result.survivors[i].second);
+        }
+
+        rowCount++;
+        survivorCount += result.survivors.size();
+    }
+
+    // Дописывает буферы в столбцы, затем заменяет checkpoint целиком через rename:
+    // оборвавшаяся запись оставляет прежнюю контрольную точку
+    bool checkpoint(string& error)
+    {
+        for (int i = 0; i < (int)columns.size(); i++)
+        {
+            columns[i].file.write(columns[i].buffer.data(), columns[i].buffer.size());
+            columns[i].file.flush();
+            columns[i].buffer.clear();
+        }
+
+        namesFile.write(newNames.data(), newNames.size());
+        namesFile.flush();
+        namesBytes += newNames.size();
+        newNames.clear();
+
+        for (int i = 0; i < (int)columns.size(); i++)
+        {
+            if (!columns[i].file) {
+                error = "не удалось записать " + columnPath(columns[i].fileName);
+                return false;
+            }
+        }
+
+        string temporary = directory + "/checkpoint.tmp";
+        {
+            ofstream file(temporary, ios::trunc);
+            file << "sweep=" << sweepHash << " rows=" << rowCount << " survivors=" << survivorCount
+                << " names=" << namesBytes << std::endl;
+            if (!file) {
+                error = "не удалось записать " + temporary;
+                return false;
+            }
+        }
+
+        std::error_code code;
+        filesystem::rename(temporary, directory + "/checkpoint", code);
+        if (code) {
+            error = "не удалось обновить контрольную точку в " + directory;
+            return false;
+        }
+
+        return true;
+    }
+
+    static bool readCheckpoint(string directory, uint64_t& sweepHash, uint64_t& rowCount, uint64_t& survivorCount, uint64_t& namesBytes)
+    {
+        ifstream file(directory + "/checkpoint");
+        string line;
+        if (!getline(file, line)) {
+            return false;
+        }
+
+        unsigned long long hash, rows, survivors, names;
+        if (sscanf(line.c_str(), "sweep=%llu rows=%llu survivors=%llu names=%llu", &hash, &rows, &survivors, &names) != 4) {
+            return false;
+        }
+
+        sweepHash = hash;
+        rowCount = rows;
+        survivorCount = survivors;
+        namesBytes = names;
+        return true;
+    }
+
+private:
+    struct Column
+    {
+        string fileName;
+        int width;
+        vector<char> buffer;
+        ofstream file;
+
+        Column(string fileName, int width) : fileName(fileName), width(width) {}
+    };
+
+    // Первые survivorColumns столбцов идут по строке на бой, остальные — по строке на выжившего
+    static const int survivorColumns = 5;
+
+    vector<Column> columns;
+    string directory;
+    uint64_t sweepHash = 0;
+    uint64_t rowCount = 0;
+    uint64_t survivorCount = 0;
+    map<string, uint32_t> nameIds;
+    ofstream namesFile;
+    uint64_t namesBytes = 0;
+    string newNames;
+
+    string columnPath(string fileName)
+    {
+        return directory + "/" + fileName + ".bin";
+    }
+
+    template<typename T>
+    void put(Column& column, T value)
+    {
+        const char* bytes = (const char*)&value;
+        column.buffer.insert(column.buffer.end(), bytes, bytes + sizeof(T));
+    }
+
+    uint32_t findNameId(const string& name)
+    {
+        auto found = nameIds.find(name);
+        if (found != nameIds.end()) {
+            return found->second;
+        }
+
+        uint32_t id = (uint32_t)nameIds.size();
+        nameIds[name] = id;
+        newNames += name + "\n";
+        return id;
+    }
+
+    // Отрезает незафиксированный хвост; недостающий файл создаётся пустым
+    bool truncate(string path, uint64_t size, string& error)
+    {
+        std::error_code code;
+        if (!filesystem::exists(path)) {
+            ofstream(path, ios::binary);
+        }
+
+        if (filesystem::file_size(path, code) < size || code) {
+            error = "файл " + path + " короче контрольной точки";
+            return false;
+        }
+
+        filesystem::resize_file(path, size, code);
+        if (code) {
+            error = "не удалось обрезать " + path;
+            return false;
+        }
+
+        return true;
+    }
+};
+
+// Разбирает строку вида "seed=42 size=10 rounds=1000 terrain=caves bear.armor=12 bear.dice=2d6 bear*2 wolf*4 vs barbarian*2 pathfinder*2"
+bool parseScenario(string line, Scenario& scenario, string& error)
+{
+    CreatureBuilder builder;
+    vector<CreatureNames>* team = &scenario.team1;
+    istringstream tokens(line);
+    string token;
+
+    while (tokens >> token)
+    {
+        size_t assign = token.find('=');
+        size_t times = token.find('*');
+
+        if (token == "vs") {
+            team = &scenario.team2;
+        }
+        else if (assign != string::npos) {
+            string key = token.substr(0, assign);
+            long long value = atoll(token.substr(assign + 1).c_str());
+
+            size_t dot = key.find('.');
+            CreatureNames creatureName;
+
+            if (dot != string::npos && builder.findByTypeName(key.substr(0, dot), creatureName)) {
+                string field = key.substr(dot + 1);
+                CreatureOverride& creatureOverride = scenario.overrides[creatureName];
+
+                if (field == "armor") { creatureOverride.armor = (int)value; }
+                else if (field == "atk") { creatureOverride.bonusAtack = (int)value; }
+                else if (field == "ini") { creatureOverride.bonusIniciative = (int)value; }
+                else if (field == "dice") {
+                    int number = 0, maxNumber = 0;
+                    if (sscanf(token.substr(assign + 1).c_str(), "%dd%d", &number, &maxNumber) != 2 || number < 1 || maxNumber < 1) {
+                        error = "кости задаются как NdM: " + token;
+                        return false;
+                    }
+
+                    creatureOverride.weaponNumberDiceRoll = number;
+                    creatureOverride.weaponMaxDiceNumber = maxNumber;
+                }
+                else {
+                    error = "неизвестная характеристика " + token;
+                    return false;
+                }
+            }
+            else if (key == "terrain") {
+                if (!findTerrainByName(token.substr(assign + 1), scenario.terrain)) {
+                    error = "неизвестная местность " + token;
+                    return false;
+                }
+            }
+            else if (key == "seed") { scenario.seed = (unsigned int)value; }
+            else if (key == "size" && value > 0) { scenario.areaSize = (int)value; }
+            else if (key == "rounds" && value > 0) { scenario.maxRounds = (int)value; }
+            else {
+                error = "неизвестный параметр " + token;
+                return false;
+            }
+        }
+        else {
+            CreatureNames creatureName;
+            int count = times == string::npos ? 1 : atoi(token.substr(times + 1).c_str());
+
+            if (!builder.findByTypeName(token.substr(0, times), creatureName) || count < 1) {
+                error = "неизвестное существо " + token;
+                return false;
+            }
+
+            team->insert(team->end(), count, creatureName);
+        }
+    }
+
+    if (scenario.team1.empty() || scenario.team2.empty()) {
+        error = "у каждой команды должен быть хотя бы один боец";
+        return false;
+    }
+
+    if (scenario.team1.size() + scenario.team2.size() > scenario.areaSize * scenario.areaSize) {
+        error = "бойцы не помещаются на поле";
+        return false;
+    }
+
+    return true;
+}
+
+void coutBattleResult(int number, BattleResult result)
+{
+    cout << number << " seed=" << result.seed << " winner=" << result.winnerTeamId
+        << " rounds=" << result.rounds << " survivors=";
+
+    for (int i = 0; i < (int)result.survivors.size(); i++)
+    {
+        cout << (i ? "," : "") << result.survivors[i].first << ":" << result.survivors[i].second;
+    }
+
+    cout << std::endl;
+}
+
+// Обходит строки stdin, пропуская пустые и комментарии "#". Если onLine вернул false,
+// его error печатается с номером строки и чтение продолжается со следующей
+void forEachInputLine(function<bool(int lineNumber, const string& line, string& error)> onLine)
+{
+    string line;
+    int lineNumber = 0;
+
+    while (getline(cin, line))
+    {
+        lineNumber++;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        string error;
+        if (!onLine(lineNumber, line, error)) {
+            cerr << "строка " << lineNumber << ": " << error << std::endl;
+        }
+    }
+}
+
+// То же, но строка сразу разбирается в сценарий; зерно по умолчанию — номер строки
+void forEachInputScenario(function<bool(int lineNumber, Scenario& scenario, string& error)> onScenario)
+{
+    forEachInputLine([&](int lineNumber, const string& line, string& error) {
+        Scenario scenario;
+        scenario.seed = lineNumber;
+        return parseScenario(line, scenario, error) && onScenario(lineNumber, scenario, error);
+    });
+}
+
+// Разбирает параметры режима вида key=value. onOption возвращает false на незнакомый
+// ключ или плохое значение — тогда печатается его error (без error — что ключ
+// неизвестен) и весь разбор не удался
+bool forEachOption(const vector<string>& options, function<bool(const string& key, const string& value, string& error)> onOption)
+{
+    for (int i = 0; i < (int)options.size(); i++)
+    {
+        string key = options[i].substr(0, options[i].find('='));
+        string value = options[i].substr(key.size() + (key.size() < options[i].size()));
+        string error;
+
+        if (!onOption(key, value, error)) {
+            cerr << (error.empty() ? "неизвестный параметр " + options[i] : error) << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Замена сервиса для локальной проверки: сценарии по одному на строку из stdin,
+// результаты в stdout в порядке сценариев
+int runBatch(int workerCount)
+{
+    BattleScheduler scheduler(workerCount);
+    deque<pair<int, future<BattleResult>>> results;
+
+    forEachInputScenario([&](int lineNumber, Scenario& scenario, string&) {
+        results.push_back({ lineNumber, scheduler.submit(scenario) });
+
+        // Отдаём готовые результаты сразу, не дожидаясь конца ввода
+        while (!results.empty() && results.front().second.wait_for(chrono::seconds(0)) == future_status::ready)
+        {
+            coutBattleResult(results.front().first, results.front().second.get());
+            results.pop_front();
+        }
+
+        return true;
+    });
+
+    while (!results.empty())
+    {
+        coutBattleResult(results.front().first, results.front().second.get());
+        results.pop_front();
+    }
+
+    return 0;
+}
+
+// Проверка движения на поле: бои из stdin как в --batch, но по каждому печатается,
+// какая доля ходов строила маршрут заново и какая упёрлась в занятую клетку.
+// Параметры replans= и blocked= — наибольшие допустимые доли; если хоть один бой
+// их превысил, код возврата 1
+int runMovement(int workerCount, vector<string> options)
+{
+    double maxReplans = 1, maxBlocked = 1;
+
+    bool isParsed = forEachOption(options, [&](const string& key, const string& value, string& error) {
+        if (key == "replans") { maxReplans = atof(value.c_str()); }
+        else if (key == "blocked") { maxBlocked = atof(value.c_str()); }
+        else { return false; }
+        return true;
+    });
+
+    if (!isParsed) {
+        return 1;
+    }
+
+    BattleScheduler scheduler(workerCount);
+    vector<pair<int, future<BattleResult>>> results;
+
+    forEachInputScenario([&](int lineNumber, Scenario& scenario, string&) {
+        results.push_back({ lineNumber, scheduler.submit(scenario) });
+        return true;
+    });
+
+    bool isPassed = true;
+    for (int i = 0; i < (int)results.size(); i++)
+    {
+        MovementStats stats = results[i].second.get().movement;
+        double replans = stats.moves ? (double)stats.replans / stats.moves : 0;
+        double blocked = stats.moves ? (double)stats.blocked / stats.moves : 0;
+        bool isOk = replans <= maxReplans && blocked <= maxBlocked;
+        isPassed = isPassed && isOk;
+
+        cout << results[i].first << " moves=" << stats.moves << " plans=" << stats.plans << " replans=" << stats.replans << " (" << replans
+            << ") blocked=" << stats.blocked << " (" << blocked << ")" << (isOk ? "" : " FAIL") << std::endl;
+    }
+
+    return isPassed ? 0 : 1;
+}
+
+// Серия боёв на пакетном ядре: по строке-сценарию из stdin, в stdout — сводка по серии
+int runLanes(int battleCount)
+{
+    forEachInputScenario([&](int lineNumber, Scenario& scenario, string&) {
+        vector<BattleResult> results = LaneBattleKernel(scenario).run(battleCount);
+        int wins[3] = { 0, 0, 0 };
+        long long rounds = 0;
+
+        for (int i = 0; i < (int)results.size(); i++)
+        {
+            wins[results[i].winnerTeamId]++;
+            rounds += results[i].rounds;
+        }
+
+        cout << lineNumber << " battles=" << results.size() << " team1=" << wins[1] << " team2=" << wins[2]
+            << " draws=" << wins[0] << " rounds=" << (results.empty() ? 0.0 : (double)rounds / results.size()) << std::endl;
+        return true;
+    });
+
+    return 0;
+}
+
+// Точные вероятности исхода для сценариев из stdin. Если задано число боёв,
+// рядом печатается оценка LaneBattleKernel — для сверки пакетного ядра с точным
+// ответом. Модель без поля, поэтому в выводе model=lanes: с боями Game на поле
+// ответ сверять нельзя
+int runExact(int battleCount)
+{
+    ExactOutcomeSolver solver;
+
+    forEachInputScenario([&](int lineNumber, Scenario& scenario, string& error) {
+        ExactOutcome outcome;
+        if (!solver.solve(scenario, outcome, error)) {
+            return false;
+        }
+
+        cout << lineNumber << " model=lanes team1=" << outcome.team1 << " team2=" << outcome.team2
+            << " states=" << outcome.states;
+
+        if (battleCount > 0)
+        {
+            vector<BattleResult> results = LaneBattleKernel(scenario).run(battleCount);
+            int wins = 0;
+            for (int i = 0; i < (int)results.size(); i++) {
+                wins += results[i].winnerTeamId == 1;
+            }
+
+            cout << " sampled=" << (double)wins / battleCount;
+        }
+
+        cout << std::endl;
+        return true;
+    });
+
+    return 0;
+}
+
+// Серии боёв до нужной точности: по строке-сценарию из stdin, в stdout —
+// сколько боёв понадобилось и оценка вероятности победы команды 1.
+// Параметры: ci=0.01 или sprt=0.45:0.55, alpha=, beta=, max=, window=
+int runAdaptive(int workerCount, vector<string> options)
+{
+    double halfWidth = 0.01, p0 = 0, p1 = 0, alpha = 0.05, beta = 0.05;
+    int maxBattles = 1000000;
+    int window = 64 * max(workerCount, 1);
+
+    bool isParsed = forEachOption(options, [&](const string& key, const string& value, string& error) {
+        if (key == "ci") { halfWidth = atof(value.c_str()); }
+        else if (key == "sprt") {
+            char rest;
+            if (sscanf(value.c_str(), "%lf:%lf%c", &p0, &p1, &rest) != 2 || !(0 < p0 && p0 < p1 && p1 < 1)) {
+                error = "sprt задаётся как p0:p1, где 0 < p0 < p1 < 1: " + value;
+                return false;
+            }
+        }
+        else if (key == "alpha") { alpha = atof(value.c_str()); }
+        else if (key == "beta") { beta = atof(value.c_str()); }
+        else if (key == "max") { maxBattles = atoi(value.c_str()); }
+        else if (key == "window") { window = atoi(value.c_str()); }
+        else { return false; }
+        return true;
+    });
+
+    if (!isParsed) {
+        return 1;
+    }
+
+    BattleScheduler scheduler(workerCount);
+    AdaptiveRunner runner(scheduler, window);
+
+    forEachInputScenario([&](int lineNumber, Scenario& scenario, string&) {
+        WinRateTest test = p1 > 0
+            ? WinRateTest::sprt(p0, p1, alpha, beta, maxBattles)
+            : WinRateTest::confidenceInterval(halfWidth, maxBattles);
+        test = runner.run(scenario, test);
+
+        cout << lineNumber << " battles=" << test.getBattles() << " team1=" << test.getWins()
+            << " p=" << test.getWinRate() << " ci=[" << test.getCenter() - test.getHalfWidth()
+            << ", " << test.getCenter() + test.getHalfWidth() << "] verdict=" << test.getVerdict() << std::endl;
+        return true;
+    });
+
+    return 0;
+}
+
+// Раскрывает строку серии: значение "a..b" перебирает целые от a до b, "x,y" — перечисленное.
+// Получается декартово произведение, последний параметр меняется быстрее всех:
+// "bear.armor=10..11 bear.dice=1d6,2d6 bear vs wolf*2" даёт четыре сценария
+vector<string> expandSweepLine(string line)
+{
+    vector<vector<string>> choices;
+    istringstream tokens(line);
+    string token;
+
+    while (tokens >> token)
+    {
+        size_t assign = token.find('=');
+        string value = assign == string::npos ? "" : token.substr(assign + 1);
+        string prefix = token.substr(0, assign + 1);
+        size_t dots = value.find("..");
+        vector<string> alternatives;
+
+        if (dots != string::npos) {
+            int from = atoi(value.substr(0, dots).c_str());
+            int to = atoi(value.substr(dots + 2).c_str());
+
+            for (int v = from; v <= to; v++) {
+                alternatives.push_back(prefix + to_string(v));
+            }
+        }
+        else if (value.find(',') != string::npos) {
+            istringstream values(value);
+            string item;
+
+            while (getline(values, item, ',')) {
+                alternatives.push_back(prefix + item);
+            }
+        }
+        else {
+            alternatives.push_back(token);
+        }
+
+        if (alternatives.empty()) {
+            return {};
+        }
+
+        choices.push_back(alternatives);
+    }
+
+    vector<string> lines;
+    vector<int> position(choices.size(), 0);
+
+    while (true)
+    {
+        string expanded;
+        for (int i = 0; i < (int)choices.size(); i++) {
+            expanded += (i ? " " : "") + choices[i][position[i]];
+        }
+        lines.push_back(expanded);
+
+        int i = (int)choices.size() - 1;
+        while (i >= 0 && ++position[i] == (int)choices[i].size()) {
+            position[i--] = 0;
+        }
+
+        if (i < 0) {
+            return lines;
+        }
+    }
+}
+
+// Серия боёв со сбросом результатов в столбцы каталога directory. Строки серии из stdin,
+// каждый сценарий играется battles раз с зёрнами seed + i. Повторный запуск с тем же
+// вводом продолжает серию с последней контрольной точки
+int runSweep(string directory, int workerCount, vector<string> options)
+{
+    int battles = 1000;
+    int checkpointEvery = 100000;
+
+    bool isParsed = forEachOption(options, [&](const string& key, const string& value, string&) {
+        if (key == "battles") { battles = atoi(value.c_str()); }
+        else if (key == "every") { checkpointEvery = atoi(value.c_str()); }
+        else { return false; }
+        return true;
+    });
+
+    if (!isParsed) {
+        return 1;
+    }
+
+    if (battles < 1 || checkpointEvery < 1) {
+        cerr << "battles и every должны быть положительными" << std::endl;
+        return 1;
+    }
+
+    vector<Scenario> scenarios;
+    vector<string> scenarioLines;
+
+    // Строка с ошибкой пропускается целиком, чтобы номера сценариев не зависели от того,
+    // какие из её вариантов разобрались
+    forEachInputLine([&](int, const string& line, string& error) {
+        vector<string> expanded = expandSweepLine(line);
+        vector<Scenario> parsed(expanded.size());
+
+        for (int i = 0; i < (int)expanded.size(); i++)
+        {
+            parsed[i].seed = 1;
+            if (!parseScenario(expanded[i], parsed[i], error)) {
+                return false;
+            }
+        }
+
+        scenarios.insert(scenarios.end(), parsed.begin(), parsed.end());
+        scenarioLines.insert(scenarioLines.end(), expanded.begin(), expanded.end());
+        return true;
+    });
+
+    // FNV-1a по раскрытым сценариям и числу боёв
+    uint64_t sweepHash = 14695981039346656037ull;
+    string sweepText = to_string(battles) + "\n";
+    for (int i = 0; i < (int)scenarioLines.size(); i++) {
+        sweepText += scenarioLines[i] + "\n";
+    }
+    for (int i = 0; i < (int)sweepText.size(); i++) {
+        sweepHash = (sweepHash ^ (unsigned char)sweepText[i]) * 1099511628211ull;
+    }
+
+    ResultSink sink;
+    string error;
+    if (!sink.open(directory, sweepHash, error)) {
+        cerr << error << std::endl;
+        return 1;
+    }
+
+    {
+        ofstream file(directory + "/scenarios.txt", ios::trunc);
+        file << sweepText.substr(sweepText.find('\n') + 1);
+    }
+
+    uint64_t total = (uint64_t)scenarios.size() * battles;
+    uint64_t resumedFrom = sink.getRowCount();
+    uint64_t next = resumedFrom;
+    uint64_t window = 64 * (uint64_t)max(workerCount, 1);
+
+    BattleScheduler scheduler(workerCount);
+    deque<pair<uint32_t, future<BattleResult>>> results;
+
+    // Результаты пишутся строго по порядку боёв, иначе нельзя продолжить с номера строки
+    while (next < total || !results.empty())
+    {
+        while (next < total && results.size() < window)
+        {
+            uint32_t scenarioIndex = (uint32_t)(next / battles);
+            Scenario battle = scenarios[scenarioIndex];
+            battle.seed = scenarios[scenarioIndex].seed + (unsigned int)(next % battles);
+            results.push_back({ scenarioIndex, scheduler.submit(battle) });
+            next++;
+        }
+
+        sink.append(results.front().first, results.front().second.get());
+        results.pop_front();
+
+        if (sink.getRowCount() % checkpointEvery == 0 && !sink.checkpoint(error)) {
+            cerr << error << std::endl;
+            return 1;
+        }
+    }
+
+    if (!sink.checkpoint(error)) {
+        cerr << error << std::endl;
+        return 1;
+    }
+
+    cout << "scenarios=" << scenarios.size() << " rows=" << sink.getRowCount() << " resumed=" << resumedFrom << std::endl;
+    return 0;
+}
+
+// Сводка по каталогу серии одним последовательным проходом по столбцам:
+// на сценарий — число боёв, победы команд, ничьи, средние раунды и хп выживших
+int runAggregate(string directory)
+{
+    uint64_t sweepHash, rowCount, survivorCount, namesBytes;
+    if (!ResultSink::readCheckpoint(directory, sweepHash, rowCount, survivorCount, namesBytes)) {
+        cerr << "в каталоге " << directory << " нет контрольной точки" << std::endl;
+        return 1;
+    }
+
+    vector<string> scenarioLines;
+    ifstream scenariosFile(directory + "/scenarios.txt");
+    string line;
+    while (getline(scenariosFile, line)) {
+        scenarioLines.push_back(line);
+    }
+
+    struct Totals
+    {
+        uint64_t battles = 0;
+        uint64_t wins[3] = { 0, 0, 0 };
+        uint64_t rounds = 0;
+        uint64_t survivors = 0;
+        int64_t survivorHp = 0;
+    };
+    vector<Totals> totals(scenarioLines.size());
+
+    ifstream scenarioColumn(directory + "/scenario.bin", ios::binary);
+    ifstream winnerColumn(directory + "/winner.bin", ios::binary);
+    ifstream roundsColumn(directory + "/rounds.bin", ios::binary);
+    ifstream survivorsColumn(directory + "/survivors.bin", ios::binary);
+    ifstream hpColumn(directory + "/survivor_hp.bin", ios::binary);
+
+    const uint64_t blockRows = 1 << 16;
+    vector<uint32_t> scenarioIndex(blockRows), rounds(blockRows);
+    vector<uint8_t> winner(blockRows);
+    vector<uint16_t> survivors(blockRows);
+    vector<int16_t> hp;
+
+    for (uint64_t start = 0; start < rowCount; start += blockRows)
+    {
+        uint64_t count = min(blockRows, rowCount - start);
+        scenarioColumn.read((char*)scenarioIndex.data(), count * sizeof(uint32_t));
+        winnerColumn.read((char*)winner.data(), count * sizeof(uint8_t));
+        roundsColumn.read((char*)rounds.data(), count * sizeof(uint32_t));
+        survivorsColumn.read((char*)survivors.data(), count * sizeof(uint16_t));
+
+        uint64_t blockSurvivors = 0;
+        for (uint64_t i = 0; i < count; i++) {
+            blockSurvivors += survivors[i];
+        }
+        hp.resize(blockSurvivors);
+        hpColumn.read((char*)hp.data(), blockSurvivors * sizeof(int16_t));
+
+        if (!scenarioColumn || !winnerColumn || !roundsColumn || !survivorsColumn || !hpColumn) {
+            cerr << "столбцы в " << directory << " короче контрольной точки" << std::endl;
+            return 1;
+        }
+
+        uint64_t survivor = 0;
+        for (uint64_t i = 0; i < count; i++)
+        {
+            if (scenarioIndex[i] >= totals.size()) {
+                totals.resize(scenarioIndex[i] + 1);
+                scenarioLines.resize(scenarioIndex[i] + 1);
+            }
+
+            Totals& scenarioTotals = totals[scenarioIndex[i]];
+            scenarioTotals.battles++;
+            scenarioTotals.wins[min<int>(winner[i], 2)]++;
+            scenarioTotals.rounds += rounds[i];
+            scenarioTotals.survivors += survivors[i];
+
+            for (int k = 0; k < survivors[i]; k++) {
+                scenarioTotals.survivorHp += hp[survivor++];
+            }
+        }
+    }
+
+    for (int i = 0; i < (int)totals.size(); i++)
+    {
+        Totals& scenarioTotals = totals[i];
+        if (scenarioTotals.battles == 0) {
+            continue;
+        }
+
+        double battles = (double)scenarioTotals.battles;
+        cout << i << " battles=" << scenarioTotals.battles << " team1=" << scenarioTotals.wins[1]
+            << " team2=" << scenarioTotals.wins[2] << " draws=" << scenarioTotals.wins[0]
+            << " p=" << scenarioTotals.wins[1] / battles << " rounds=" << scenarioTotals.rounds / battles
+            << " survivorHp=" << (scenarioTotals.survivors ? (double)scenarioTotals.survivorHp / scenarioTotals.survivors : 0)
+            << " | " << scenarioLines[i] << std::endl;
+    }
+
+    return 0;
+}
+
+// Генерирует одну арену и печатает время, долю свободных клеток и число областей
+int runTerrain(string terrainName, int size, unsigned int seed, int threadCount)
+{
+    TerrainNames terrainKind;
+    if (!findTerrainByName(terrainName, terrainKind) || size < 1) {
+        cerr << "нужно: --terrain field|caves|forest|rooms размер [зерно] [потоки]" << std::endl;
+        return 1;
+    }
+
+    auto start = chrono::steady_clock::now();
+    Terrain terrain = TerrainGenerator(256, threadCount).generate(terrainKind, size, size, seed);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if (terrain.grid.rows == 0) {
+        cerr << "поле слишком большое" << std::endl;
+        return 1;
+    }
+
+    long long freeCells = 0;
+    for (size_t i = 0; i < terrain.grid.cells.size(); i++) {
+        freeCells += terrain.grid.cells[i];
+    }
+
+    cout << terrainName << " " << size << "x" << size << " seed=" << seed << " seconds=" << seconds
+        << " free=" << (double)freeCells / terrain.grid.cells.size() << " regions=" << terrain.regionCount << std::endl;
+
+    // Небольшие арены удобно посмотреть глазами
+    for (int x = 0; size <= 80 && x < size; x++)
+    {
+        for (int y = 0; y < size; y++) {
+            cout << (terrain.grid.at(x, y) ? '.' : '#');
+        }
+        cout << std::endl;
+    }
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    setlocale(LC_ALL, "Russian");
+    srand(time(0));
+
+    if (argc > 1 && string(argv[1]) == "--batch") {
+        int workerCount = argc > 2 ? atoi(argv[2]) : (int)thread::hardware_concurrency();
+        return runBatch(workerCount);
+    }
+
+    if (argc > 1 && string(argv[1]) == "--adaptive") {
+        int workerCount = argc > 2 && isdigit(argv[2][0]) ? atoi(argv[2]) : (int)thread::hardware_concurrency();
+        int firstOption = argc > 2 && isdigit(argv[2][0]) ? 3 : 2;
+        return runAdaptive(workerCount, vector<string>(argv + firstOption, argv + argc));
+    }
+
+    if (argc > 1 && string(argv[1]) == "--movement") {
+        int workerCount = argc > 2 && isdigit(argv[2][0]) ? atoi(argv[2]) : (int)thread::hardware_concurrency();
+        int firstOption = argc > 2 && isdigit(argv[2][0]) ? 3 : 2;
+        return runMovement(workerCount, vector<string>(argv + firstOption, argv + argc));
+    }
+
+    if (argc > 2 && string(argv[1]) == "--sweep") {
+        int workerCount = argc > 3 && isdigit(argv[3][0]) ? atoi(argv[3]) : (int)thread::hardware_concurrency();
+        int firstOption = argc > 3 && isdigit(argv[3][0]) ? 4 : 3;
+        return runSweep(argv[2], workerCount, vector<string>(argv + firstOption, argv + argc));
+    }
+
+    if (argc > 2 && string(argv[1]) == "--aggregate") {
+        return runAggregate(argv[2]);
+    }
+
+    if (argc > 3 && string(argv[1]) == "--terrain") {
+        unsigned int seed = argc > 4 ? (unsigned int)atoll(argv[4]) : 1;
+        int threadCount = argc > 5 ? atoi(argv[5]) : (int)thread::hardware_concurrency();
+        return runTerrain(argv[2], atoi(argv[3]), seed, threadCount);
+    }
+
+    if (argc > 1 && string(argv[1]) == "--exact") {
+        return runExact(argc > 2 ? atoi(argv[2]) : 0);
+    }
+
+    if (argc > 2 && string(argv[1]) == "--lanes") {
+        return runLanes(atoi(argv[2]));
+    }
+
     Game game = Game();
     game.StartGame();
     int i;